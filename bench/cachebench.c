@@ -0,0 +1,289 @@
+/***************************************************************************
+ *  Title: Oversubscribed Cache Benchmark
+ * -------------------------------------------------------------------------
+ *    Purpose: Runs more threads than there are CPUs, four per CPU by
+ *             default, through allocators with per-CPU and per-thread
+ *             caches. Every thread keeps a window of blocks and replaces
+ *             a random one per step. Besides the throughput it reports
+ *             the peak pages and the pages still held once every thread
+ *             has freed its window but not yet exited, which is what
+ *             the caches keep to themselves.
+ *    File: $RCSfile: cachebench.c,v $
+ ***************************************************************************/
+
+/************System include***********************************************/
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/************Private include**********************************************/
+#include "../kpage.h"
+#include "../kma.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#define MAXTHREADS 1024
+
+#define DEFALLOCATORS "p2fl+pcpu,p2fl+tcache,mck2+pcpu,mck2+tcache," \
+  "bud+pcpu,bud+tcache"
+
+/* request sizes are drawn log-uniformly from MINSIZE to MAXSIZE */
+#define MINSIZE 16
+#define MAXSIZE 2048
+
+typedef struct
+{
+  pthread_t thread;
+  unsigned long long rng;
+  struct timespec t0, t1;      // when it started and had freed its window
+} worker_t;
+
+typedef struct
+{
+  void* ptr;
+  kma_size_t size;
+} block_t;
+
+/************Global Variables*********************************************/
+
+/* see usage() */
+static long long nsteps = 200000;
+static int window = 64;
+
+/* all threads start together, and wait after freeing their windows */
+static pthread_barrier_t start, drained, done;
+
+/************Function Prototypes******************************************/
+static void run(kma_ops_t*, int);
+static void* churn(void*);
+static unsigned long long next(unsigned long long*);
+static void usage(char*);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+int
+main(int argc, char* argv[])
+{
+  kma_ops_t* selected[MAXALLOCATORS];
+  char* names = DEFALLOCATORS;
+  char* alg;
+  int factor = 4, ncpus, n_sel = 0, i, c;
+  
+  while ((c = getopt(argc, argv, "a:o:n:w:")) != -1)
+    {
+      switch (c)
+	{
+	case 'a':
+	  names = optarg;
+	  break;
+	case 'o':
+	  factor = atoi(optarg);
+	  break;
+	case 'n':
+	  nsteps = atoll(optarg);
+	  break;
+	case 'w':
+	  window = atoi(optarg);
+	  break;
+	default:
+	  usage(argv[0]);
+	}
+    }
+  
+  ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (factor < 1 || ncpus < 1 || factor * ncpus > MAXTHREADS || nsteps < 1
+      || window < 1)
+    {
+      usage(argv[0]);
+    }
+  
+  names = strdup(names);
+  for (alg = strtok(names, ","); alg != NULL; alg = strtok(NULL, ","))
+    {
+      if (n_sel == MAXALLOCATORS || kma_find(alg) == NULL)
+	{
+	  error("unknown allocator", alg);
+	}
+      selected[n_sel++] = kma_find(alg);
+    }
+  
+  printf("%d CPUs, %d threads, %lld steps of %d blocks each\n", ncpus,
+	 factor * ncpus, nsteps, window);
+  printf("%-16s %12s %10s %10s %12s\n", "allocator", "time (s)", "Mops/s",
+	 "peak pages", "cached pages");
+  for (i = 0; i < n_sel; i++)
+    {
+      run(selected[i], factor * ncpus);
+    }
+  free(names);
+  
+  return 0;
+}
+
+void
+error(char* message, char* arg)
+{
+  fprintf(stderr, "ERROR: %s: %s.\n", message, arg);
+  exit(-1);
+}
+
+/* runs nsteps steps on each of n threads and prints one line */
+static void
+run(kma_ops_t* alg, int n)
+{
+  worker_t* workers = malloc(n * sizeof(worker_t));
+  double first = 0, last = 0, t0, t1;
+  int t, cached;
+  
+  assert(workers != NULL);
+  if (!(alg->flags & KMA_THREADSAFE))
+    {
+      error("not thread-safe", alg->name);
+    }
+  
+  kma_use(alg);
+  pthread_barrier_init(&start, NULL, n + 1);
+  pthread_barrier_init(&drained, NULL, n + 1);
+  pthread_barrier_init(&done, NULL, n + 1);
+  for (t = 0; t < n; t++)
+    {
+      workers[t].rng = 0x9e3779b97f4a7c15ULL * (t + 1);
+      if (pthread_create(&workers[t].thread, NULL, churn, &workers[t]) != 0)
+	{
+	  error("unable to create thread", "");
+	}
+    }
+  
+  // the threads may be well under way before this one returns from
+  // the barrier, so each reads the clock itself
+  pthread_barrier_wait(&start);
+  pthread_barrier_wait(&drained);
+  // nothing is allocated now but what the caches hold
+  cached = pages_in_use();
+  pthread_barrier_wait(&done);
+  for (t = 0; t < n; t++)
+    {
+      pthread_join(workers[t].thread, NULL);
+      t0 = workers[t].t0.tv_sec + workers[t].t0.tv_nsec * 1e-9;
+      t1 = workers[t].t1.tv_sec + workers[t].t1.tv_nsec * 1e-9;
+      if (t == 0 || t0 < first)
+	{
+	  first = t0;
+	}
+      if (t == 0 || t1 > last)
+	{
+	  last = t1;
+	}
+    }
+  pthread_barrier_destroy(&start);
+  pthread_barrier_destroy(&drained);
+  pthread_barrier_destroy(&done);
+  
+  if (alg->flush != NULL)
+    {
+      alg->flush();
+    }
+  if (pages_in_use() != 0)
+    {
+      error("not all pages freed", alg->name);
+    }
+  
+  // each step is one free and one malloc
+  printf("%-16s %12.6f %10.2f %10d %12d\n", alg->name, last - first,
+	 2e-6 * nsteps * n / (last - first), pages_peak(), cached);
+  
+  kma_done();
+  free(workers);
+}
+
+static void*
+churn(void* arg)
+{
+  worker_t* w = arg;
+  block_t* blocks = malloc(window * sizeof(block_t));
+  unsigned long long r;
+  long long step;
+  int i;
+  
+  assert(blocks != NULL);
+  pthread_barrier_wait(&start);
+  clock_gettime(CLOCK_MONOTONIC, &w->t0);
+  
+  for (i = 0; i < window; i++)
+    {
+      blocks[i].ptr = NULL;
+    }
+  for (step = 0; step < nsteps; step++)
+    {
+      r = next(&w->rng);
+      i = r % window;
+      if (blocks[i].ptr != NULL)
+	{
+	  kma_free(blocks[i].ptr, blocks[i].size);
+	}
+      // the top bits pick a power of two, the next ones a size in it
+      blocks[i].size = MINSIZE << ((r >> 60) % 8);
+      blocks[i].size += (r >> 32) % blocks[i].size;
+      if (blocks[i].size > MAXSIZE)
+	{
+	  blocks[i].size = MAXSIZE;
+	}
+      blocks[i].ptr = kma_malloc(blocks[i].size);
+      if (blocks[i].ptr == NULL)
+	{
+	  error("out of memory", "");
+	}
+      // touch it, as a caller would
+      *(long*) blocks[i].ptr = step;
+    }
+  
+  for (i = 0; i < window; i++)
+    {
+      if (blocks[i].ptr != NULL)
+	{
+	  kma_free(blocks[i].ptr, blocks[i].size);
+	}
+    }
+  free(blocks);
+  clock_gettime(CLOCK_MONOTONIC, &w->t1);
+  
+  pthread_barrier_wait(&drained);
+  pthread_barrier_wait(&done);
+  return NULL;
+}
+
+/* xorshift64*, one state per thread */
+static unsigned long long
+next(unsigned long long* s)
+{
+  *s ^= *s >> 12;
+  *s ^= *s << 25;
+  *s ^= *s >> 27;
+  return *s * 0x2545f4914f6cdd1dULL;
+}
+
+static void
+usage(char* name)
+{
+  printf("Usage: %s [-a allocator[,allocator...]] [-o factor] [-n steps] "
+	 "[-w window]\n"
+	 "  -a  thread-safe allocators to compare (default\n"
+	 "      %s)\n"
+	 "  -o  threads per online CPU (default 4)\n"
+	 "  -n  free-and-malloc steps per thread (default 200000)\n"
+	 "  -w  blocks each thread holds (default 64)\n"
+	 "Sizes are drawn from %d to %d bytes.\n", name, DEFALLOCATORS,
+	 MINSIZE, MAXSIZE);
+  exit(1);
+}
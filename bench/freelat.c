@@ -0,0 +1,154 @@
+/***************************************************************************
+ *  Title: Free Latency Benchmark
+ * -------------------------------------------------------------------------
+ *    Purpose: Measures the cost of kma_free() and kma_malloc() as the
+ *             live heap grows. For each heap size it fills the heap with
+ *             randomly sized blocks, then repeatedly frees a random half
+ *             and allocates it again, timing the two phases separately.
+ *             With constant-time free lists the per-op cost stays flat.
+ *             The allocator is picked by name (default: bud).
+ *    File: $RCSfile: freelat.c,v $
+ ***************************************************************************/
+
+/************System include***********************************************/
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <math.h>
+
+/************Private include**********************************************/
+#include "../kpage.h"
+#include "../kma.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#define MINLIVE (1 << 10)
+#define MAXLIVE (1 << 18)
+#define ROUNDS 8
+
+/* request sizes are log-distributed like the testsuite traces */
+#define MINSIZE 8
+#define MAXSIZE 4000
+
+/************Global Variables*********************************************/
+
+static void* ptrs[MAXLIVE];
+static int sizes[MAXLIVE];
+static int order[MAXLIVE];
+
+/************Function Prototypes******************************************/
+static double now();
+static int random_size();
+static void shuffle(int*, int);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+int
+main(int argc, char* argv[])
+{
+  kma_ops_t* alg;
+  int live, i, r;
+  
+  alg = kma_find(argc > 1 ? argv[1] : "bud");
+  if (alg == NULL)
+    {
+      error("unknown allocator", argv[1]);
+    }
+  kma_use(alg);
+  
+  srandom(1);
+  
+  printf("allocator: %s\n", alg->name);
+  printf("%10s %12s %12s\n", "live", "ns/free", "ns/malloc");
+  
+  for (live = MINLIVE; live <= MAXLIVE; live <<= 1)
+    {
+      double tfree = 0, tmalloc = 0, start;
+      int half = live / 2;
+      
+      for (i = 0; i < live; i++)
+	{
+	  sizes[i] = random_size();
+	  ptrs[i] = kma_malloc(sizes[i]);
+	  assert(ptrs[i] != NULL);
+	  order[i] = i;
+	}
+      
+      for (r = 0; r < ROUNDS; r++)
+	{
+	  shuffle(order, live);
+	  
+	  start = now();
+	  for (i = 0; i < half; i++)
+	    {
+	      kma_free(ptrs[order[i]], sizes[order[i]]);
+	    }
+	  tfree += now() - start;
+	  
+	  start = now();
+	  for (i = 0; i < half; i++)
+	    {
+	      ptrs[order[i]] = kma_malloc(sizes[order[i]]);
+	    }
+	  tmalloc += now() - start;
+	}
+      
+      for (i = 0; i < live; i++)
+	{
+	  kma_free(ptrs[i], sizes[i]);
+	}
+      
+      printf("%10d %12.1f %12.1f\n", live,
+	     tfree * 1e9 / ((double) half * ROUNDS),
+	     tmalloc * 1e9 / ((double) half * ROUNDS));
+    }
+  
+  kma_done();
+  return 0;
+}
+
+void
+error(char* message, char* arg)
+{
+  fprintf(stderr, "ERROR: %s: %s.\n", message, arg);
+  exit(-1);
+}
+
+static double
+now()
+{
+  struct timespec ts;
+  
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int
+random_size()
+{
+  double lo = MINSIZE, hi = MAXSIZE;
+  
+  return (int) (lo * exp(log(hi / lo) * random() / RAND_MAX));
+}
+
+static void
+shuffle(int* a, int n)
+{
+  int i, j, t;
+  
+  for (i = n - 1; i > 0; i--)
+    {
+      j = random() % (i + 1);
+      t = a[i];
+      a[i] = a[j];
+      a[j] = t;
+    }
+}
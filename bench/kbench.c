@@ -0,0 +1,468 @@
+/***************************************************************************
+ *  Title: Allocator Benchmark
+ * -------------------------------------------------------------------------
+ *    Purpose: Replays every trace against every registered allocator and
+ *             writes the results as CSV or JSON, optionally checking
+ *             them against a stored baseline
+ *    File: $RCSfile: kbench.c,v $
+ ***************************************************************************/
+
+/************System include***********************************************/
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+
+/************Private include**********************************************/
+#include "../kpage.h"
+#include "../kma.h"
+#include "../ktrace.h"
+#include "../khist.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#define MAXREPS 100
+#define MAXRESULTS 1024
+
+/* the results header, also the first line of a baseline file */
+#define CSVHEADER "allocator,trace,reps,median_s,best_s,ops_per_s," \
+  "peak_pages,waste_mean,waste_tw,peak_rss_kb"
+
+typedef struct
+{
+  char alg[64];
+  char trace[256];
+  int reps;
+  double median;     // allocator-only seconds, median over the reps
+  double best;
+  double opsps;      // ops per allocator-only second, from the median
+  int peak;          // most pages in use at once
+  double wastemean;  // mean over ops of waste / requested bytes
+  double wastetw;    // waste integrated over the trace / bytes integrated
+  long rss;          // resident set when the pages peaked, in KB
+} result_t;
+
+/************Global Variables*********************************************/
+
+static result_t results[MAXRESULTS];
+static int nresults = 0;
+
+/* live blocks of the current replay, indexed by request id */
+static void** ptrs;
+static int* sizes;
+
+/************Function Prototypes******************************************/
+static void run(kma_ops_t*, char*, ktrace_t*, int, int);
+static double replay(ktrace_t*, result_t*);
+static long rss_kb();
+static int by_double(const void*, const void*);
+static void write_csv(FILE*);
+static void write_json(FILE*);
+static int check(char*, double);
+static void pin(int);
+static void usage(char*);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+int
+main(int argc, char* argv[])
+{
+  kma_ops_t* selected[MAXALLOCATORS];
+  char* list = "all";
+  char* alg;
+  char* out = NULL;
+  char* baseline = NULL;
+  char* format = "csv";
+  double threshold = 0.05;
+  int reps = 5, warmup = 1, cpu = -1;
+  int n_sel = 0, i, t, c, bad = 0;
+  ktrace_t trace;
+  FILE* f;
+  
+  while ((c = getopt(argc, argv, "a:n:w:c:f:o:b:t:")) != -1)
+    {
+      switch (c)
+	{
+	case 'a':
+	  list = optarg;
+	  break;
+	case 'n':
+	  reps = atoi(optarg);
+	  break;
+	case 'w':
+	  warmup = atoi(optarg);
+	  break;
+	case 'c':
+	  cpu = atoi(optarg);
+	  break;
+	case 'f':
+	  format = optarg;
+	  break;
+	case 'o':
+	  out = optarg;
+	  break;
+	case 'b':
+	  baseline = optarg;
+	  break;
+	case 't':
+	  threshold = atof(optarg);
+	  break;
+	default:
+	  usage(argv[0]);
+	}
+    }
+  
+  if (optind == argc || reps < 1 || reps > MAXREPS || warmup < 0
+      || (strcmp(format, "csv") != 0 && strcmp(format, "json") != 0))
+    {
+      usage(argv[0]);
+    }
+  
+  if (strcmp(list, "all") == 0)
+    {
+      for (i = 0; i < kma_count(); i++)
+	{
+	  selected[n_sel++] = kma_get(i);
+	}
+    }
+  else
+    {
+      for (alg = strtok(list, ","); alg != NULL; alg = strtok(NULL, ","))
+	{
+	  if (n_sel == MAXALLOCATORS || kma_find(alg) == NULL)
+	    {
+	      error("unknown allocator", alg);
+	    }
+	  selected[n_sel++] = kma_find(alg);
+	}
+    }
+  
+  pin(cpu);
+  hist_calibrate();
+  
+  for (t = optind; t < argc; t++)
+    {
+      trace_open(argv[t], &trace);
+      ptrs = malloc((trace.hdr.n_req + 1) * sizeof(void*));
+      sizes = malloc((trace.hdr.n_req + 1) * sizeof(int));
+      assert(ptrs != NULL && sizes != NULL);
+  
+      for (i = 0; i < n_sel; i++)
+	{
+	  run(selected[i], argv[t], &trace, reps, warmup);
+	}
+  
+      free(ptrs);
+      free(sizes);
+      trace_close(&trace);
+    }
+  
+  f = stdout;
+  if (out != NULL && (f = fopen(out, "w")) == NULL)
+    {
+      error("unable to open output file", out);
+    }
+  if (strcmp(format, "csv") == 0)
+    {
+      write_csv(f);
+    }
+  else
+    {
+      write_json(f);
+    }
+  if (f != stdout)
+    {
+      fclose(f);
+    }
+  
+  if (baseline != NULL)
+    {
+      bad = check(baseline, threshold);
+    }
+  
+  return bad ? 1 : 0;
+}
+
+void
+error(char* message, char* arg)
+{
+  fprintf(stderr, "ERROR: %s: %s.\n", message, arg);
+  exit(-1);
+}
+
+/* replays one trace reps times after warmup untimed runs */
+static void
+run(kma_ops_t* alg, char* file, ktrace_t* trace, int reps, int warmup)
+{
+  result_t* res;
+  double secs[MAXREPS];
+  int i;
+  
+  if (nresults == MAXRESULTS)
+    {
+      error("too many results", "");
+    }
+  res = &results[nresults++];
+  memset(res, 0, sizeof(result_t));
+  snprintf(res->alg, sizeof(res->alg), "%s", alg->name);
+  snprintf(res->trace, sizeof(res->trace), "%s", file);
+  res->reps = reps;
+  
+  for (i = -warmup; i < reps; i++)
+    {
+      kma_use(alg);
+      // the replay is deterministic, so the last run's memory figures
+      // are as good as any
+      secs[i < 0 ? 0 : i] = replay(trace, res);
+      kma_done();
+    }
+  
+  qsort(secs, reps, sizeof(double), by_double);
+  res->best = secs[0];
+  res->median = reps % 2 ? secs[reps / 2]
+    : (secs[reps / 2 - 1] + secs[reps / 2]) / 2;
+  res->opsps = res->median > 0 ? trace->hdr.n_ops / res->median : 0;
+  
+  fprintf(stderr, "%-10s %-28s %10.6f s %12.0f ops/s %6d pages %6.3f waste\n",
+	  res->alg, res->trace, res->median, res->opsps, res->peak,
+	  res->wastetw);
+}
+
+/*  Replays a trace without touching the blocks and returns the time
+ *  spent inside the allocator. The page statistics are read between
+ *  calls, outside the timed part.
+ */
+static double
+replay(ktrace_t* trace, result_t* res)
+{
+  ktrace_op_t* op = trace->ops;
+  unsigned long long i, ticks = 0, t;
+  double ratiosum = 0, wastesum = 0, bytesum = 0;
+  long long ratiocount = 0, live = 0, waste;
+  
+  res->peak = 0;
+  
+  for (i = 0; i < trace->hdr.n_ops; i++, op++)
+    {
+      if (op->size != OPFREE)
+	{
+	  t = hist_now();
+	  ptrs[op->id] = kma_malloc(op->size);
+	  ticks += hist_now() - t;
+	  if (ptrs[op->id] == NULL)
+	    {
+	      sizes[op->id] = 0;
+	      continue;
+	    }
+	  sizes[op->id] = op->size;
+	  live += op->size;
+	}
+      else
+	{
+	  if (sizes[op->id] == 0)
+	    { // the request was refused
+	      continue;
+	    }
+	  t = hist_now();
+	  kma_free(ptrs[op->id], sizes[op->id]);
+	  ticks += hist_now() - t;
+	  live -= sizes[op->id];
+	}
+  
+      if (pages_in_use() > res->peak)
+	{ // the counters are live, so this costs a load and a compare
+	  res->peak = pages_in_use();
+	  res->rss = rss_kb();
+	}
+      if (live > 0)
+	{
+	  waste = page_bytes_in_use() - live;
+	  ratiosum += (double) waste / live;
+	  ratiocount++;
+	  wastesum += waste;
+	  bytesum += live;
+	}
+    }
+  
+  res->wastemean = ratiocount ? ratiosum / ratiocount : 0;
+  res->wastetw = bytesum > 0 ? wastesum / bytesum : 0;
+  
+  return ticks * ghistns * 1e-9;
+}
+
+/* the resident set of the process, in KB */
+static long
+rss_kb()
+{
+  long pages = 0, resident = 0;
+  FILE* f = fopen("/proc/self/statm", "r");
+  
+  if (f == NULL)
+    {
+      return 0;
+    }
+  if (fscanf(f, "%ld %ld", &pages, &resident) != 2)
+    {
+      resident = 0;
+    }
+  fclose(f);
+  
+  return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static int
+by_double(const void* a, const void* b)
+{
+  double x = *(const double*) a, y = *(const double*) b;
+  
+  return x < y ? -1 : x > y;
+}
+
+static void
+write_csv(FILE* f)
+{
+  result_t* r;
+  int i;
+  
+  fprintf(f, "%s\n", CSVHEADER);
+  for (i = 0; i < nresults; i++)
+    {
+      r = &results[i];
+      fprintf(f, "%s,%s,%d,%.9f,%.9f,%.0f,%d,%.6f,%.6f,%ld\n",
+	      r->alg, r->trace, r->reps, r->median, r->best, r->opsps,
+	      r->peak, r->wastemean, r->wastetw, r->rss);
+    }
+}
+
+static void
+write_json(FILE* f)
+{
+  result_t* r;
+  int i;
+  
+  fprintf(f, "[\n");
+  for (i = 0; i < nresults; i++)
+    {
+      r = &results[i];
+      fprintf(f, "  {\"allocator\": \"%s\", \"trace\": \"%s\", \"reps\": %d, "
+	      "\"median_s\": %.9f, \"best_s\": %.9f, \"ops_per_s\": %.0f, "
+	      "\"peak_pages\": %d, \"waste_mean\": %.6f, \"waste_tw\": %.6f, "
+	      "\"peak_rss_kb\": %ld}%s\n",
+	      r->alg, r->trace, r->reps, r->median, r->best, r->opsps,
+	      r->peak, r->wastemean, r->wastetw, r->rss,
+	      i + 1 < nresults ? "," : "");
+    }
+  fprintf(f, "]\n");
+}
+
+/*  Compares the results with a baseline written by an earlier run in
+ *  CSV. A result regresses if its median time or its time-weighted
+ *  waste grew by more than threshold; the waste is deterministic, so
+ *  any growth past the threshold is real.
+ */
+static int
+check(char* file, double threshold)
+{
+  char line[512];
+  result_t b;
+  int i, bad = 0, found = 0;
+  FILE* f = fopen(file, "r");
+  
+  if (f == NULL)
+    {
+      error("unable to open baseline", file);
+    }
+  if (fgets(line, sizeof(line), f) == NULL
+      || strncmp(line, CSVHEADER, strlen(CSVHEADER)) != 0)
+    {
+      error("baseline is not a results file", file);
+    }
+  
+  while (fgets(line, sizeof(line), f) != NULL)
+    {
+      if (sscanf(line, "%63[^,],%255[^,],%d,%lf,%lf,%lf,%d,%lf,%lf,%ld",
+		 b.alg, b.trace, &b.reps, &b.median, &b.best, &b.opsps,
+		 &b.peak, &b.wastemean, &b.wastetw, &b.rss) != 10)
+	{
+	  error("malformed baseline line", line);
+	}
+  
+      for (i = 0; i < nresults; i++)
+	{
+	  result_t* r = &results[i];
+  
+	  if (strcmp(r->alg, b.alg) != 0 || strcmp(r->trace, b.trace) != 0)
+	    {
+	      continue;
+	    }
+	  found++;
+  
+	  if (r->median > b.median * (1 + threshold))
+	    {
+	      fprintf(stderr, "REGRESSION %s %s: median %.6f s vs %.6f s "
+		      "(%+.1f%%)\n", r->alg, r->trace, r->median, b.median,
+		      (r->median / b.median - 1) * 100);
+	      bad++;
+	    }
+	  if (r->wastetw > b.wastetw * (1 + threshold) + 1e-9)
+	    {
+	      fprintf(stderr, "REGRESSION %s %s: waste %.4f vs %.4f\n",
+		      r->alg, r->trace, r->wastetw, b.wastetw);
+	      bad++;
+	    }
+	}
+    }
+  fclose(f);
+  
+  fprintf(stderr, "%d results compared with %s, %d regressions "
+	  "(threshold %.0f%%)\n", found, file, bad, threshold * 100);
+  
+  return bad;
+}
+
+/* keeps the benchmark on one CPU, so migrations do not add noise */
+static void
+pin(int cpu)
+{
+  cpu_set_t set;
+  
+  if (cpu < 0)
+    {
+      cpu = sched_getcpu();
+    }
+  
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (sched_setaffinity(0, sizeof(set), &set) == -1)
+    {
+      fprintf(stderr, "warning: unable to pin to CPU %d\n", cpu);
+    }
+}
+
+static void
+usage(char* name)
+{
+  int i;
+  
+  printf("Usage: %s [-a allocator[,allocator...]|all] [-n reps] "
+	 "[-w warmups]\n"
+	 "       [-c cpu] [-f csv|json] [-o file] [-b baseline.csv "
+	 "[-t threshold]]\n"
+	 "       traceFile...\n", name);
+  printf("Allocators:");
+  for (i = 0; i < kma_count(); i++)
+    {
+      printf(" %s", kma_get(i)->name);
+    }
+  printf("\n");
+  exit(0);
+}
@@ -0,0 +1,245 @@
+/***************************************************************************
+ *  Title: Page Contention Benchmark
+ * -------------------------------------------------------------------------
+ *    Purpose: Hammers get_pages() and free_pages() from 1 to n threads.
+ *             Every thread keeps a window of pages and replaces a random
+ *             one per step, mostly single pages with a share of small
+ *             blocks. Built as pagebench with the lock-free page stack
+ *             and as pagebench_mutex with -DKPAGE_MUTEX, where every
+ *             call takes the pool lock.
+ *    File: $RCSfile: pagebench.c,v $
+ ***************************************************************************/
+
+/************System include***********************************************/
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/************Private include**********************************************/
+#include "../kpage.h"
+#include "../kma.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#define MAXTHREADS 64
+
+/* blocks other than single pages are of order 1 to MAXMIXORDER */
+#define MAXMIXORDER 3
+
+typedef struct
+{
+  pthread_t thread;
+  unsigned long long rng;
+  pthread_barrier_t* start;
+  struct timespec t0, t1;      // when it started and finished its steps
+} worker_t;
+
+/************Global Variables*********************************************/
+
+/* see usage() */
+static long long nsteps = 1000000;
+static int window = 64;
+static double mix = 0.1;
+
+/************Function Prototypes******************************************/
+static double run(int);
+static void* hammer(void*);
+static unsigned long long next(unsigned long long*);
+static void usage(char*);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+int
+main(int argc, char* argv[])
+{
+  int maxthreads = 4, k, c;
+  double seconds, base = 0;
+  
+  while ((c = getopt(argc, argv, "t:n:w:m:")) != -1)
+    {
+      switch (c)
+	{
+	case 't':
+	  maxthreads = atoi(optarg);
+	  break;
+	case 'n':
+	  nsteps = atoll(optarg);
+	  break;
+	case 'w':
+	  window = atoi(optarg);
+	  break;
+	case 'm':
+	  mix = atof(optarg);
+	  break;
+	default:
+	  usage(argv[0]);
+	}
+    }
+  
+  if (maxthreads < 1 || maxthreads > MAXTHREADS || nsteps < 1 || window < 1
+      || mix < 0 || mix > 1)
+    {
+      usage(argv[0]);
+    }
+  
+#ifdef KPAGE_MUTEX
+  printf("kpage: every call under the pool lock\n");
+#else
+  printf("kpage: lock-free stack for single pages\n");
+#endif
+  printf("%8s %12s %10s %10s %8s\n", "threads", "time (s)", "Mops/s",
+	 "ns/op", "speedup");
+  
+  for (k = 1; k <= maxthreads; k++)
+    {
+      seconds = run(k);
+      if (k == 1)
+	{
+	  base = seconds;
+	}
+      // each step is one free and one get, and every thread runs
+      // nsteps, so the speedup is the ratio of throughputs
+      printf("%8d %12.6f %10.2f %10.1f %7.2fx\n", k, seconds,
+	     2e-6 * nsteps * k / seconds, seconds * 1e9 / (2 * nsteps),
+	     k * base / seconds);
+    }
+  
+  return 0;
+}
+
+void
+error(char* message, char* arg)
+{
+  fprintf(stderr, "ERROR: %s: %s.\n", message, arg);
+  exit(-1);
+}
+
+/* runs nsteps steps on each of n threads, returns the wall time from
+ * the first thread starting its steps to the last one finishing them */
+static double
+run(int n)
+{
+  worker_t workers[MAXTHREADS];
+  pthread_barrier_t start;
+  double first = 0, last = 0, t0, t1;
+  kpage_stat_t* stat;
+  int t;
+  
+  pthread_barrier_init(&start, NULL, n + 1);
+  for (t = 0; t < n; t++)
+    {
+      workers[t].rng = 0x9e3779b97f4a7c15ULL * (t + 1);
+      workers[t].start = &start;
+      if (pthread_create(&workers[t].thread, NULL, hammer, &workers[t]) != 0)
+	{
+	  error("unable to create thread", "");
+	}
+    }
+  
+  // the threads may be well under way before this one returns from
+  // the barrier, so each reads the clock itself
+  pthread_barrier_wait(&start);
+  for (t = 0; t < n; t++)
+    {
+      pthread_join(workers[t].thread, NULL);
+      t0 = workers[t].t0.tv_sec + workers[t].t0.tv_nsec * 1e-9;
+      t1 = workers[t].t1.tv_sec + workers[t].t1.tv_nsec * 1e-9;
+      if (t == 0 || t0 < first)
+	{
+	  first = t0;
+	}
+      if (t == 0 || t1 > last)
+	{
+	  last = t1;
+	}
+    }
+  pthread_barrier_destroy(&start);
+  
+  stat = page_stats();
+  if (stat->num_requested != stat->num_freed || stat->num_in_use != 0)
+    {
+      error("not all pages freed", "");
+    }
+  page_teardown();
+  
+  return last - first;
+}
+
+static void*
+hammer(void* arg)
+{
+  worker_t* w = arg;
+  kpage_t** pages = malloc(window * sizeof(kpage_t*));
+  unsigned long long r;
+  long long step;
+  int i, order;
+  
+  assert(pages != NULL);
+  for (i = 0; i < window; i++)
+    {
+      pages[i] = get_page();
+      assert(pages[i] != NULL);
+    }
+  
+  pthread_barrier_wait(w->start);
+  clock_gettime(CLOCK_MONOTONIC, &w->t0);
+  
+  for (step = 0; step < nsteps; step++)
+    {
+      r = next(&w->rng);
+      i = r % window;
+      // the top 53 bits draw the kind of block
+      order = (r >> 11) * 0x1.0p-53 < mix ? 1 + (r >> 8) % MAXMIXORDER : 0;
+  
+      free_pages(pages[i]);
+      pages[i] = get_pages(order);
+      if (pages[i] == NULL)
+	{
+	  error("pool exhausted", "");
+	}
+      // touch it, as a caller would
+      *(long*) pages[i]->ptr = step;
+    }
+  clock_gettime(CLOCK_MONOTONIC, &w->t1);
+  
+  for (i = 0; i < window; i++)
+    {
+      free_pages(pages[i]);
+    }
+  free(pages);
+  
+  return NULL;
+}
+
+/* xorshift64*, one state per thread */
+static unsigned long long
+next(unsigned long long* s)
+{
+  *s ^= *s >> 12;
+  *s ^= *s << 25;
+  *s ^= *s >> 27;
+  return *s * 0x2545f4914f6cdd1dULL;
+}
+
+static void
+usage(char* name)
+{
+  printf("Usage: %s [-t threads] [-n steps] [-w window] [-m share]\n"
+	 "  -t threads  scale from 1 to this many threads (default 4)\n"
+	 "  -n steps    free-and-get steps per thread (default 1000000)\n"
+	 "  -w window   pages each thread holds (default 64)\n"
+	 "  -m share    share of blocks of order 1 to %d (default 0.1)\n",
+	 name, MAXMIXORDER);
+  exit(1);
+}
@@ -0,0 +1,169 @@
+/***************************************************************************
+ *  Title: Page Buddy
+ * -------------------------------------------------------------------------
+ *    Purpose: Binary buddy of the blocks within a page, with one pair
+ *             bitmap per page, shared by the buddy allocators
+ *    File: $RCSfile: kbuddy.c,v $
+ ***************************************************************************/
+#define __KBUDDY_IMPL__
+
+/************System include***********************************************/
+#include <assert.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+/************Private include**********************************************/
+#include "kpage.h"
+#include "kma.h"
+#include "kbuddy.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* first bit of level l in a map */
+#define MAPBASE(l) ((PAGESIZE >> MINCLASSSHIFT) - ((PAGESIZE >> MINCLASSSHIFT) >> (l)))
+
+/* bit of the pair holding the block at offset off on level l */
+#define MAPBIT(l, off) (MAPBASE(l) + ((off) >> ((l) + MINCLASSSHIFT + 1)))
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+static void mapinit(kbuddy_t*);
+static int flip(kbuddy_map_t*, int, int);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+void
+buddy_init(kbuddy_t* bd)
+{
+  int i;
+  
+  for (i = 0; i < PAGELEVEL; i++)
+    {
+      klist_init(&bd->free[i]);
+    }
+  bd->maps = NULL;
+  bd->nmaps = 0;
+}
+
+void
+buddy_teardown(kbuddy_t* bd)
+{
+  if (bd->maps != NULL)
+    {
+      munmap(bd->maps, (size_t) bd->nmaps * sizeof(kbuddy_map_t));
+      bd->maps = NULL;
+      bd->nmaps = 0;
+    }
+}
+
+void*
+buddy_alloc(kbuddy_t* bd, int level)
+{
+  kpage_t* page;
+  klist_t* blk;
+  kbuddy_map_t* map;
+  int cur, off;
+  
+  assert(level >= 0 && level < PAGELEVEL);
+  
+  if (bd->maps == NULL)
+    {
+      mapinit(bd);
+    }
+  
+  // smallest level with a free block
+  for (cur = level; cur < PAGELEVEL; cur++)
+    {
+      if (!klist_empty(&bd->free[cur]))
+	{
+	  break;
+	}
+    }
+  
+  if (cur == PAGELEVEL)
+    { // none, split a new page
+      page = get_page();
+      if (page == NULL)
+	{
+	  return NULL;
+	}
+      blk = (klist_t*)page->ptr;
+    }
+  else
+    {
+      blk = klist_pop(&bd->free[cur]);
+    }
+  
+  map = &bd->maps[page_frame(blk)];
+  off = (void*)blk - BASEADDR(blk);
+  if (cur < PAGELEVEL)
+    {
+      flip(map, cur, off);
+    }
+  
+  // keep the lower half, put the upper half on the free list
+  while (cur > level)
+    {
+      cur--;
+      klist_add(&bd->free[cur], (klist_t*)((void*)blk + CLASSSIZE(cur)));
+      flip(map, cur, off);
+    }
+  
+  return blk;
+}
+
+int
+buddy_free(kbuddy_t* bd, void* ptr, int level)
+{
+  void* base = BASEADDR(ptr);
+  kbuddy_map_t* map = &bd->maps[page_frame(ptr)];
+  int off = ptr - base;
+  int merges = 0;
+  
+  // merge while the buddy is free, all the way up to the page
+  while (level < PAGELEVEL)
+    {
+      if (flip(map, level, off))
+	{
+	  klist_add(&bd->free[level], (klist_t*)(base + off));
+	  return merges;
+	}
+      klist_del((klist_t*)(base + (off ^ CLASSSIZE(level))));
+      merges++;
+      off &= ~CLASSSIZE(level);
+      level++;
+    }
+  
+  free_page(page_lookup(base));
+  return merges;
+}
+
+/* maps are indexed by frame number, so size them to the pool */
+static void
+mapinit(kbuddy_t* bd)
+{
+  bd->nmaps = page_capacity();
+  bd->maps = mmap(NULL, (size_t) bd->nmaps * sizeof(kbuddy_map_t),
+		  PROT_READ | PROT_WRITE,
+		  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (bd->maps == MAP_FAILED)
+    error("Error using mmap to allocate the buddy maps", "");
+}
+
+/* flips the pair bit of a block and returns its new value */
+static int
+flip(kbuddy_map_t* map, int level, int off)
+{
+  int bit = MAPBIT(level, off);
+  
+  map->bits[bit / 64] ^= 1UL << (bit % 64);
+  return (map->bits[bit / 64] >> (bit % 64)) & 1;
+}
@@ -0,0 +1,109 @@
+/***************************************************************************
+ *  Title: Page Buddy
+ * -------------------------------------------------------------------------
+ *    Purpose: Binary buddy of the blocks within a page, with one pair
+ *             bitmap per page, shared by the buddy allocators
+ *    File: $RCSfile: kbuddy.h,v $
+ ***************************************************************************/
+
+#ifndef __KBUDDY_H__
+#define __KBUDDY_H__
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+#include "kpage.h"
+#include "kclass.h"
+#include "klist.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __KBUDDY_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/*  Blocks are power-of-two classes of a page, from MINCLASSSIZE (level 0)
+ *  up to the page itself (level PAGELEVEL). A block at level l and
+ *  offset off has its buddy at off ^ (MINCLASSSIZE << l).
+ *
+ *  Each page has a map with one bit per buddy pair and level, set when
+ *  exactly one of the two buddies is free. Freeing a block flips its
+ *  bit; if the bit drops to 0 the buddy is free too and the two merge.
+ *  The map is all zeroes while the page is wholly free or wholly split
+ *  into used blocks, so maps need no initialisation. They are kept
+ *  until buddy_teardown(), so a heap that keeps emptying does not remap
+ *  them.
+ */
+#define PAGELEVEL (NUMCLASSES - 1)
+
+/* bits for levels 0 .. PAGELEVEL-1: half the blocks of each level */
+#define MAPBITS ((PAGESIZE >> MINCLASSSHIFT) - 1)
+#define MAPWORDS ((MAPBITS + 63) / 64)
+
+typedef struct
+{
+  unsigned long bits[MAPWORDS];
+} kbuddy_map_t;
+
+typedef struct
+{
+  klist_t free[PAGELEVEL];  // free blocks per level
+  kbuddy_map_t* maps;       // one per page frame, backed only where touched
+  int nmaps;
+} kbuddy_t;
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Starts a page buddy
+ * ---------------------------------------------------------------------
+ *    Purpose: Empties the free lists; the maps are mapped on first use
+ *    Input: the buddy
+ *    Output: none
+ ***********************************************************************/
+EXTERN void buddy_init(kbuddy_t* bd);
+
+/***********************************************************************
+ *  Title: Ends a page buddy
+ * ---------------------------------------------------------------------
+ *    Purpose: Gives the maps back, once every block has been freed
+ *    Input: the buddy
+ *    Output: none
+ ***********************************************************************/
+EXTERN void buddy_teardown(kbuddy_t* bd);
+
+/***********************************************************************
+ *  Title: Allocates a block
+ * ---------------------------------------------------------------------
+ *    Purpose: Takes the smallest free block of at least the level,
+ *             or a new page, and splits it down to the level
+ *    Input: the buddy and the level (0 <= level < PAGELEVEL)
+ *    Output: the block, or NULL if the pool is exhausted
+ ***********************************************************************/
+EXTERN void* buddy_alloc(kbuddy_t* bd, int level);
+
+/***********************************************************************
+ *  Title: Frees a block
+ * ---------------------------------------------------------------------
+ *    Purpose: Merges the block with its buddy for as long as the buddy
+ *             is free, and gives the page back once it is whole
+ *    Input: the buddy, the block and its level
+ *    Output: the number of merges done
+ ***********************************************************************/
+EXTERN int buddy_free(kbuddy_t* bd, void* ptr, int level);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __KBUDDY_H__ */
@@ -0,0 +1,113 @@
+/***************************************************************************
+ *  Title: Size Classes
+ * -------------------------------------------------------------------------
+ *    Purpose: Constant-time mapping of request sizes to the size
+ *             classes shared by the kernel memory allocators
+ *    File: $RCSfile: kclass.h,v $
+ ***************************************************************************/
+
+#ifndef __KCLASS_H__
+#define __KCLASS_H__
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+#include "kpage.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __KCLASS_IMPL__
+#define EXTERN 
+#else
+#define EXTERN extern
+#endif
+
+/*  Power-of-two classes: class c holds blocks of 2^(c + MINCLASSSHIFT)
+ *  bytes, from 16 bytes up to a whole page.
+ */
+#define MINCLASSSHIFT 4
+#define MINCLASSSIZE (1 << MINCLASSSHIFT)
+#define NUMCLASSES (PAGESHIFT - MINCLASSSHIFT + 1)
+
+/*  Fine classes: 16-byte steps up to 128 bytes, then four classes per
+ *  doubling up to a whole page. Sizes up to FINEMAPMAX are looked up
+ *  in a table, larger ones are computed from the leading bit.
+ */
+#define NUMFINECLASSES 32
+#define FINEMAPMAX 1024
+
+typedef struct
+{
+  int size;   // block size of the class
+  int objs;   // blocks that fit in one page
+  int waste;  // bytes of a page left over after objs blocks
+} kclass_t;
+
+/************Global Variables*********************************************/
+
+EXTERN const kclass_t gclass[NUMCLASSES];
+EXTERN const kclass_t gfineclass[NUMFINECLASSES];
+EXTERN const unsigned char gfinemap[FINEMAPMAX / MINCLASSSIZE + 1];
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Power-of-two class of a size
+ * ---------------------------------------------------------------------
+ *    Purpose: Finds the smallest power-of-two class that holds size
+ *             bytes with a count-leading-zeros instead of a loop
+ *    Input: the size in bytes (1 <= size <= PAGESIZE)
+ *    Output: the class index
+ ***********************************************************************/
+static inline int
+size_class(int size)
+{
+  if (size <= MINCLASSSIZE)
+    {
+      return 0;
+    }
+  return (32 - __builtin_clz(size - 1)) - MINCLASSSHIFT;
+}
+
+/***********************************************************************
+ *  Title: Fine class of a size
+ * ---------------------------------------------------------------------
+ *    Purpose: Finds the smallest fine class that holds size bytes
+ *    Input: the size in bytes (1 <= size <= PAGESIZE)
+ *    Output: the class index
+ ***********************************************************************/
+static inline int
+fine_class(int size)
+{
+  int bit;
+  
+  if (size <= FINEMAPMAX)
+    {
+      return gfinemap[(size + MINCLASSSIZE - 1) >> MINCLASSSHIFT];
+    }
+  
+  // 8 classes up to 128 bytes, then 4 per doubling, picked by the two
+  // bits below the leading one
+  bit = 31 - __builtin_clz(size - 1);
+  return 8 + (bit - 7) * 4 + (((size - 1) >> (bit - 2)) & 3);
+}
+
+#define CLASSSIZE(c) (gclass[c].size)
+#define CLASSOBJS(c) (gclass[c].objs)
+#define CLASSWASTE(c) (gclass[c].waste)
+
+#define FINESIZE(c) (gfineclass[c].size)
+#define FINEOBJS(c) (gfineclass[c].objs)
+#define FINEWASTE(c) (gfineclass[c].waste)
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __KCLASS_H__ */
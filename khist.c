@@ -0,0 +1,123 @@
+/***************************************************************************
+ *  Title: Latency Histograms
+ * -------------------------------------------------------------------------
+ *    Purpose: Cheap timestamps and log-linear histograms for timing
+ *             single allocator calls
+ *    File: $RCSfile: khist.c,v $
+ ***************************************************************************/
+#define __KHIST_IMPL__
+
+/************System include***********************************************/
+#include <time.h>
+
+/************Private include**********************************************/
+#include "khist.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/* how long the TSC is compared against the system clock */
+#define CALIBRATENS 20000000
+
+/************Global Variables*********************************************/
+
+double ghistns = 1.0;
+
+/************Function Prototypes******************************************/
+static unsigned long long clock_ns();
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+void
+hist_calibrate()
+{
+#ifdef __x86_64__
+  unsigned long long t0, t1, c0, c1;
+  
+  t0 = clock_ns();
+  c0 = hist_now();
+  do
+    {
+      t1 = clock_ns();
+    }
+  while (t1 - t0 < CALIBRATENS);
+  c1 = hist_now();
+  
+  ghistns = (double) (t1 - t0) / (c1 - c0);
+#else
+  ghistns = 1.0;
+#endif
+}
+
+unsigned long long
+hist_quantile(khist_t* h, double q)
+{
+  unsigned long long seen = 0, rank, end;
+  int i;
+  
+  if (h->count == 0)
+    {
+      return 0;
+    }
+  
+  rank = (unsigned long long) (q * h->count + 0.5);
+  if (rank == 0)
+    {
+      rank = 1;
+    }
+  
+  for (i = 0; i < HISTBUCKETS; i++)
+    {
+      seen += h->bucket[i];
+      if (seen >= rank)
+	{
+	  break;
+	}
+    }
+  
+  if (i < HISTSUB)
+    {
+      end = i;
+    }
+  else
+    { // last value of the bucket
+      int e = i / HISTSUB + HISTSUBBITS - 1;
+  
+      end = ((unsigned long long) (HISTSUB + i % HISTSUB + 1)
+	     << (e - HISTSUBBITS)) - 1;
+    }
+  
+  return end < h->max ? end : h->max;
+}
+
+void
+hist_merge(khist_t* dst, khist_t* src)
+{
+  int i;
+  
+  dst->count += src->count;
+  dst->sum += src->sum;
+  if (src->max > dst->max)
+    {
+      dst->max = src->max;
+    }
+  for (i = 0; i < HISTBUCKETS; i++)
+    {
+      dst->bucket[i] += src->bucket[i];
+    }
+}
+
+static unsigned long long
+clock_ns()
+{
+  struct timespec ts;
+  
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
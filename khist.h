@@ -0,0 +1,141 @@
+/***************************************************************************
+ *  Title: Latency Histograms
+ * -------------------------------------------------------------------------
+ *    Purpose: Cheap timestamps and log-linear histograms for timing
+ *             single allocator calls
+ *    File: $RCSfile: khist.h,v $
+ ***************************************************************************/
+
+#ifndef __KHIST_H__
+#define __KHIST_H__
+
+/************System include***********************************************/
+#include <time.h>
+#ifdef __x86_64__
+#include <x86intrin.h>
+#endif
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __KHIST_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/*  Values below 2^HISTSUBBITS ticks get a bucket each; above, every
+ *  power of two is split into 2^HISTSUBBITS equal buckets, so a bucket
+ *  is never wider than 1/16 of its values whatever the magnitude.
+ */
+#define HISTSUBBITS 4
+#define HISTSUB (1 << HISTSUBBITS)
+#define HISTBUCKETS (64 * HISTSUB)
+
+typedef struct
+{
+  unsigned long long count;
+  unsigned long long sum;
+  unsigned long long max;
+  unsigned long long bucket[HISTBUCKETS];
+} khist_t;
+
+/************Global Variables*********************************************/
+
+/* nanoseconds per tick, set by hist_calibrate() */
+EXTERN double ghistns;
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Reads the clock
+ * ---------------------------------------------------------------------
+ *    Purpose: Returns a timestamp in ticks: the TSC on x86-64, where
+ *             it is constant-rate and a few cycles to read, otherwise
+ *             CLOCK_MONOTONIC_RAW in nanoseconds
+ *    Input: none
+ *    Output: the timestamp
+ ***********************************************************************/
+static inline unsigned long long
+hist_now()
+{
+#ifdef __x86_64__
+  return __rdtsc();
+#else
+  struct timespec ts;
+  
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/***********************************************************************
+ *  Title: Records a value
+ * ---------------------------------------------------------------------
+ *    Purpose: Adds a value in ticks to a histogram
+ *    Input: the histogram, the value
+ *    Output: none
+ ***********************************************************************/
+static inline void
+hist_record(khist_t* h, unsigned long long v)
+{
+  int e;
+  
+  h->count++;
+  h->sum += v;
+  if (v > h->max)
+    {
+      h->max = v;
+    }
+  
+  if (v < HISTSUB)
+    {
+      h->bucket[v]++;
+      return;
+    }
+  e = 63 - __builtin_clzll(v);
+  h->bucket[(e - HISTSUBBITS + 1) * HISTSUB
+	    + ((v >> (e - HISTSUBBITS)) & (HISTSUB - 1))]++;
+}
+
+/***********************************************************************
+ *  Title: Calibrates the clock
+ * ---------------------------------------------------------------------
+ *    Purpose: Measures how many nanoseconds a tick of hist_now() is
+ *             and stores it in ghistns
+ *    Input: none
+ *    Output: none
+ ***********************************************************************/
+EXTERN void hist_calibrate();
+
+/***********************************************************************
+ *  Title: Histogram quantile
+ * ---------------------------------------------------------------------
+ *    Purpose: Finds the value below which a fraction q of the recorded
+ *             values fall, rounded up to the end of its bucket
+ *    Input: the histogram, the fraction (0 < q <= 1)
+ *    Output: the value in ticks, never above the recorded maximum
+ ***********************************************************************/
+EXTERN unsigned long long hist_quantile(khist_t*, double);
+
+/***********************************************************************
+ *  Title: Merges histograms
+ * ---------------------------------------------------------------------
+ *    Purpose: Adds every value recorded in src to dst
+ *    Input: the destination and the source histogram
+ *    Output: none
+ ***********************************************************************/
+EXTERN void hist_merge(khist_t*, khist_t*);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __KHIST_H__ */
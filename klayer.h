@@ -0,0 +1,153 @@
+/***************************************************************************
+ *  Title: Allocator Layers
+ * -------------------------------------------------------------------------
+ *    Purpose: The plumbing shared by the caches that stack on top of
+ *             another registered kernel memory allocator
+ *    File: $RCSfile: klayer.h,v $
+ ***************************************************************************/
+
+#ifndef __KLAYER_H__
+#define __KLAYER_H__
+
+/************System include***********************************************/
+#include <pthread.h>
+
+/************Private include**********************************************/
+#include "kma.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __KLAYER_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/*  A layer registers one allocator per allocator it wraps, all sharing
+ *  its functions. kma_ops_t comes first, so gkma points at the wrapper
+ *  too, and init finds the base and the option it was built with
+ *  there. Layers stack, so each keeps its own klayer_base_t for the
+ *  run, which also serialises its calls into a base that is not
+ *  thread-safe.
+ */
+typedef struct
+{
+  kma_ops_t ops;
+  kma_ops_t* base;
+  int option;              // for the layer to tell its variants apart
+} klayer_t;
+
+typedef struct
+{
+  kma_ops_t* ops;          // the allocator underneath in the current run
+  bool locked;             // whether calls into it take the lock
+  pthread_mutex_t lock;
+} klayer_base_t;
+
+#define KLAYER_BASE_INIT { NULL, FALSE, PTHREAD_MUTEX_INITIALIZER }
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Wraps an allocator in a layer
+ * ---------------------------------------------------------------------
+ *    Purpose: Registers a copy of ops named after base with suffix
+ *             appended, which runs on top of base
+ *    Input: the allocator to wrap, the suffix, the layer's functions
+ *           and the option its init will find
+ *    Output: the new allocator, or NULL if base already is one of
+ *            this layer
+ ***********************************************************************/
+EXTERN kma_ops_t* layer_wrap(kma_ops_t* base, char* suffix,
+			     const kma_ops_t* ops, int option);
+
+/***********************************************************************
+ *  Title: Starts a layer
+ * ---------------------------------------------------------------------
+ *    Purpose: Called first by the layer's init, while kma_use() points
+ *             gkma at the wrapper: fills in the base of the run and
+ *             starts it, pointing gkma at it meanwhile so that a layer
+ *             underneath finds itself the same way
+ *    Input: the layer's base of the run
+ *    Output: the wrapper being started
+ ***********************************************************************/
+EXTERN klayer_t* layer_init(klayer_base_t* b);
+
+/***********************************************************************
+ *  Title: Calls into the base
+ * ---------------------------------------------------------------------
+ *    Purpose: Bracket calls into the allocator underneath, taking the
+ *             layer's lock if that allocator is not thread-safe
+ *    Input: the layer's base of the run
+ *    Output: none
+ ***********************************************************************/
+static inline void
+layer_lock(klayer_base_t* b)
+{
+  if (b->locked)
+    {
+      pthread_mutex_lock(&b->lock);
+    }
+}
+
+static inline void
+layer_unlock(klayer_base_t* b)
+{
+  if (b->locked)
+    {
+      pthread_mutex_unlock(&b->lock);
+    }
+}
+
+/***********************************************************************
+ *  Title: Passes a single call to the base
+ * ---------------------------------------------------------------------
+ *    Purpose: malloc() and free() of the allocator underneath, under
+ *             the layer's lock if need be
+ *    Input: the layer's base of the run and the call's arguments
+ *    Output: as the base's
+ ***********************************************************************/
+static inline void*
+layer_malloc(klayer_base_t* b, kma_size_t size)
+{
+  void* res;
+  
+  layer_lock(b);
+  res = b->ops->malloc(size);
+  layer_unlock(b);
+  return res;
+}
+
+static inline void
+layer_free(klayer_base_t* b, void* ptr, kma_size_t size)
+{
+  layer_lock(b);
+  b->ops->free(ptr, size);
+  layer_unlock(b);
+}
+
+/***********************************************************************
+ *  Title: Ends a layer
+ * ---------------------------------------------------------------------
+ *    Purpose: Passes stats, flush and teardown on to the base, where
+ *             it has them, once the layer has done its own part
+ *    Input: the layer's base of the run
+ *    Output: none
+ ***********************************************************************/
+EXTERN void layer_stats(klayer_base_t* b);
+EXTERN void layer_flush(klayer_base_t* b);
+EXTERN void layer_teardown(klayer_base_t* b);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __KLAYER_H__ */
@@ -69,8 +69,44 @@
 
 typedef int kma_size_t;
 
+/*  Every algorithm fills in one of these and registers it under its
+ *  name with KMA_REGISTER, so one binary can carry all of them and
+ *  pick at run time. init and teardown bracket a run; stats is
+ *  optional and prints counters specific to the algorithm. flags and
+ *  flush are left out by most initialisers and so read 0. flush, if
+ *  set, gives back the free blocks the calling thread keeps to itself,
+ *  and those of caches no thread owns, so that all their pages can be
+ *  freed; it is only called while no other thread uses the allocator.
+ */
+typedef struct
+{
+  char* name;
+  void (*init)();
+  void* (*malloc)(kma_size_t);
+  void (*free)(void*, kma_size_t);
+  void (*stats)();
+  void (*teardown)();
+  unsigned int flags;
+  void (*flush)();
+} kma_ops_t;
+
+/* malloc and free may be called from several threads at once, and free
+ * with a block another thread allocated */
+#define KMA_THREADSAFE 0x1
+
+#define MAXALLOCATORS 32
+
+#define KMA_REGISTER(ops)                                               \
+  static void __attribute__((constructor)) register_##ops()             \
+  {                                                                     \
+    kma_register(&ops);                                                 \
+  }
+
 /************Global Variables*********************************************/
 
+/* the allocator kma_malloc() and kma_free() dispatch to */
+extern kma_ops_t* gkma;
+
 /************Function Prototypes******************************************/
 
 /***********************************************************************
@@ -95,6 +131,50 @@ EXTERN void* kma_malloc(kma_size_t size);
  ***********************************************************************/
 EXTERN void kma_free(void*, kma_size_t size);
 
+/***********************************************************************
+ *  Title: Registers an allocator
+ * ---------------------------------------------------------------------
+ *    Purpose: Adds an allocator to the registry; called through
+ *             KMA_REGISTER before main() runs
+ *    Input: the allocator
+ *    Output: none
+ ***********************************************************************/
+EXTERN void kma_register(kma_ops_t*);
+
+/***********************************************************************
+ *  Title: Looks up an allocator
+ * ---------------------------------------------------------------------
+ *    Purpose: Finds a registered allocator by position or by name.
+ *             A name ending in the suffix of a caching layer (see
+ *             kmag.h and kpcpu.h) registers the allocator the rest of
+ *             the name finds behind that layer if it is not yet.
+ *    Input: the index (0 <= i < kma_count()) or the name
+ *    Output: the allocator, or NULL if there is none
+ ***********************************************************************/
+EXTERN int kma_count();
+EXTERN kma_ops_t* kma_get(int);
+EXTERN kma_ops_t* kma_find(char*);
+
+/***********************************************************************
+ *  Title: Selects an allocator
+ * ---------------------------------------------------------------------
+ *    Purpose: Initialises an allocator and routes kma_malloc() and
+ *             kma_free() to it
+ *    Input: the allocator
+ *    Output: none
+ ***********************************************************************/
+EXTERN void kma_use(kma_ops_t*);
+
+/***********************************************************************
+ *  Title: Tears down the current allocator
+ * ---------------------------------------------------------------------
+ *    Purpose: Lets the allocator release its metadata, then tears down
+ *             the page pool, so the next kma_use() starts from scratch
+ *    Input: none
+ *    Output: none
+ ***********************************************************************/
+EXTERN void kma_done();
+
 /************External Declaration*****************************************/
 
 /**************Definition***************************************************/
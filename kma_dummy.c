@@ -44,7 +44,6 @@
  *    - initial version for the kernel memory allocator project
  *
  ***************************************************************************/
-#ifdef KMA_DUMMY
 #define __KMA_IMPL__
 
 /************System include***********************************************/
@@ -65,27 +64,37 @@
 /************Global Variables*********************************************/
 
 /************Function Prototypes******************************************/
+static void* dummy_malloc(kma_size_t);
+static void dummy_free(void*, kma_size_t);
 
 /************External Declaration*****************************************/
 
+// no state of its own, so as thread-safe as the page layer
+static kma_ops_t dummy_ops = { "dummy", NULL, dummy_malloc, dummy_free,
+			       NULL, NULL, KMA_THREADSAFE };
+KMA_REGISTER(dummy_ops)
+
 /**************Implementation***********************************************/
 
-void* kma_malloc(kma_size_t size)
+static void* dummy_malloc(kma_size_t size)
 {
   kpage_t* page;
   
-  // get one page
-  page = get_page();
-  
-  // add a pointer to the page structure at the beginning of the page
-  *((kpage_t**)page->ptr) = page;
-  
-  if ((size + sizeof(kpage_t*)) > page->size)
+  if ((size + sizeof(kpage_t*)) > (PAGESIZE << (MAXORDER - 1)))
     { // requested size too large
-      free_page(page);
       return NULL;
     }
   
+  // get one page, or as many contiguous pages as the request needs
+  page = get_pages(get_order(size + sizeof(kpage_t*)));
+  if (page == NULL)
+    { // out of pages
+      return NULL;
+    }
+  
+  // add a pointer to the page structure at the beginning of the page
+  *((kpage_t**)page->ptr) = page;
+  
   // check whether the BASEADDR macro works
   //for (i = 0; i < page->size; i++)
   //{
@@ -96,13 +105,11 @@ void* kma_malloc(kma_size_t size)
   return page->ptr + sizeof(kpage_t*);
 }
 
-void kma_free(void* ptr, kma_size_t size)
+static void dummy_free(void* ptr, kma_size_t size)
 {
   kpage_t* page;
   
   page = *((kpage_t**)(ptr - sizeof(kpage_t*)));
   
-  free_page(page);
+  free_pages(page);
 }
-
-#endif // KMA_DUMMY
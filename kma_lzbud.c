@@ -36,16 +36,20 @@
  *    - initial version for the kernel memory allocator project
  *
  ***************************************************************************/
-#ifdef KMA_LZBUD
 #define __KMA_IMPL__
 
 /************System include***********************************************/
 #include <assert.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 
 /************Private include**********************************************/
 #include "kpage.h"
 #include "kma.h"
+#include "kclass.h"
+#include "klist.h"
+#include "kbuddy.h"
 
 /************Defines and Typedefs*****************************************/
 /*  #defines and typedefs should have their names in all caps.
@@ -54,24 +58,177 @@
  *  structures and arrays, line everything up in neat columns.
  */
 
+/*  The buddy layer is the page buddy of kbuddy.c that kma_bud.c uses,
+ *  whose free lists hold the globally free blocks.
+ *
+ *  On top of it each class keeps a list of locally free blocks. A
+ *  locally free block is still allocated as far as the buddy layer is
+ *  concerned, so it can be handed out again without any map update and
+ *  never coalesces. A globally free block has been released to the
+ *  buddy layer and merged with its buddy where possible.
+ *
+ *  Whether a free is local or global depends on the slack of the class,
+ *  N - 2L - G (N blocks, L locally and G globally free), which comes
+ *  down to A - L with A blocks allocated:
+ *    slack >= 2  lazy:        free locally, defer coalescing
+ *    slack == 1  reclaiming:  free globally
+ *    slack == 0  accelerated: free globally, plus one local block
+ *  A class can then never hold more locally free blocks than allocated
+ *  ones, so they all drain once the class is idle.
+ *
+ *  On the testsuite traces this buys little over kma_bud.c. Coalescing
+ *  there is a few bit flips per merge, so deferring it saves next to
+ *  nothing: lzbud is 5-15% faster on the high-churn 5.trace and within
+ *  run-to-run noise on the others, while the deferred blocks cost it a
+ *  few peak pages and roughly 10-40% more waste on every trace. Lazy
+ *  thresholds from 2 up to 64 did not change that measurably.
+ */
+
+typedef struct
+{
+  klist_t local;   // locally free blocks
+  int nalloc;      // A: blocks handed out
+  int nlocal;      // L: blocks on the local list
+} lzclass_t;
+
 /************Global Variables*********************************************/
 
+static lzclass_t classes[PAGELEVEL];
+
+/* the globally free blocks */
+static kbuddy_t buddy;
+
+/* how much coalescing the laziness saved */
+static struct
+{
+  int deferred;     // frees kept local instead of coalescing
+  int reused;       // allocations served from a local list
+  int coalesced;    // buddy merges done
+  int accelerated;  // extra local blocks released in accelerated state
+} lzstats;
+
 /************Function Prototypes******************************************/
+static void lzbud_init();
+static void* lzbud_malloc(kma_size_t);
+static void lzbud_free(void*, kma_size_t);
+static void lzbud_stats();
+static void lzbud_teardown();
 
 /************External Declaration*****************************************/
 
+static kma_ops_t lzbud_ops = { "lzbud", lzbud_init, lzbud_malloc, lzbud_free,
+			       lzbud_stats, lzbud_teardown };
+KMA_REGISTER(lzbud_ops)
+
 /**************Implementation***********************************************/
 
-void*
-kma_malloc(kma_size_t size)
+static void
+lzbud_init()
+{
+  int i;
+  
+  for (i = 0; i < PAGELEVEL; i++)
+    {
+      klist_init(&classes[i].local);
+      classes[i].nalloc = 0;
+      classes[i].nlocal = 0;
+    }
+  buddy_init(&buddy);
+  memset(&lzstats, 0, sizeof(lzstats));
+}
+
+static void
+lzbud_teardown()
 {
-  return NULL;
+  buddy_teardown(&buddy);
 }
 
-void
-kma_free(void* ptr, kma_size_t size)
+static void*
+lzbud_malloc(kma_size_t size)
 {
-  ;
+  lzclass_t* cp;
+  kpage_t* page;
+  void* res;
+  int level;
+  
+  if (size > PAGESIZE / 2)
+    { // too large for a block, hand out whole pages
+      if (size > (PAGESIZE << (MAXORDER - 1)))
+	{
+	  return NULL;
+	}
+      page = get_pages(get_order(size));
+      return page == NULL ? NULL : page->ptr;
+    }
+  
+  level = size_class(size);
+  cp = &classes[level];
+  
+  if (!klist_empty(&cp->local))
+    { // a locally free block is still allocated to the buddy layer
+      cp->nlocal--;
+      cp->nalloc++;
+      lzstats.reused++;
+      return klist_pop(&cp->local);
+    }
+  
+  res = buddy_alloc(&buddy, level);
+  if (res != NULL)
+    {
+      cp->nalloc++;
+    }
+  return res;
 }
 
-#endif // KMA_LZBUD
+static void
+lzbud_free(void* ptr, kma_size_t size)
+{
+  lzclass_t* cp;
+  int level, slack;
+  
+  if (size > PAGESIZE / 2)
+    { // served straight from the page buddy
+      free_pages(page_lookup(ptr));
+      return;
+    }
+  
+  level = size_class(size);
+  cp = &classes[level];
+  
+  slack = cp->nalloc - cp->nlocal;
+  cp->nalloc--;
+  
+  if (slack >= 2)
+    { // lazy
+      klist_add(&cp->local, (klist_t*)ptr);
+      cp->nlocal++;
+      lzstats.deferred++;
+      return;
+    }
+  
+  lzstats.coalesced += buddy_free(&buddy, ptr, level);
+  
+  if (slack == 0 && cp->nlocal > 0)
+    { // accelerated, catch up on a deferred block as well
+      cp->nlocal--;
+      lzstats.accelerated++;
+      lzstats.coalesced += buddy_free(&buddy, klist_pop(&cp->local), level);
+    }
+}
+
+/***********************************************************************
+ *  Title: Lazy buddy statistics
+ * ---------------------------------------------------------------------
+ *    Purpose: Reports how much coalescing the lazy policy deferred
+ *             or avoided altogether
+ *    Input: none
+ *    Output: none
+ ***********************************************************************/
+static void
+lzbud_stats()
+{
+  printf("Lazy buddy: %d frees deferred, %d allocs reused a deferred block, "
+	 "%d coalesces, %d accelerated frees\n",
+	 lzstats.deferred, lzstats.reused, lzstats.coalesced,
+	 lzstats.accelerated);
+}
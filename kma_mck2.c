@@ -36,17 +36,8 @@
  *    - initial version for the kernel memory allocator project
  *
  ***************************************************************************/
-#ifdef KMA_MCK2
 #define __KMA_IMPL__
 
-/************System include***********************************************/
-#include <assert.h>
-#include <stdlib.h>
-
-/************Private include**********************************************/
-#include "kpage.h"
-#include "kma.h"
-
 /************Defines and Typedefs*****************************************/
 /*  #defines and typedefs should have their names in all caps.
  *  Global variables begin with g. Global constants with k. Local
@@ -54,24 +45,21 @@
  *  structures and arrays, line everything up in neat columns.
  */
 
-/************Global Variables*********************************************/
-
-/************Function Prototypes******************************************/
-
-/************External Declaration*****************************************/
-
-/**************Implementation***********************************************/
-
-void*
-kma_malloc(kma_size_t size)
-{
-  return NULL;
-}
-
-void
-kma_free(void* ptr, kma_size_t size)
-{
-  ;
-}
+/*  Blocks are the power-of-two classes up to half a page and carry no
+ *  header. Every page of the pool has an entry in the kmemsizes table,
+ *  indexed by frame number, that holds the class of the blocks on the
+ *  page (or KP_LARGE for the first page of a multi-page block) and how
+ *  many of them are live. Free finds the class there without touching
+ *  the block.
+ */
+#define KP_NAME mck2
+#define KP_CLASSES KP_POW2
+#define KP_SLAB 0
+#define KP_META KP_META_TABLE
+#define KP_LOCK KP_LOCK_NONE
 
-#endif // KMA_MCK2
+/************Private include**********************************************/
+/*  The policy allocator generates the implementation from the
+ *  definitions above.
+ */
+#include "kpolicy.h"
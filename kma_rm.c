@@ -35,7 +35,6 @@
  *    - initial version for the kernel memory allocator project
  *
  ***************************************************************************/
-#ifdef KMA_RM
 #define __KMA_IMPL__
 
 /************System include***********************************************/
@@ -53,24 +52,385 @@
  *  structures and arrays, line everything up in neat columns.
  */
 
+/*  The map holds the free extents of the pages it has carved. Every
+ *  extent lies within one page and is indexed twice: by address, to
+ *  find the neighbours to coalesce with on free, and by (size, address)
+ *  for best fit. Both indexes are treaps sharing one node per extent,
+ *  so every operation is O(log n) in the number of extents. Map nodes
+ *  live in pages of their own, apart from the memory they describe.
+ */
+#define ALIGNMENT 8
+#define ALIGNUP(size) (((size) + ALIGNMENT - 1) & ~(ALIGNMENT - 1))
+
+enum INDEX
+  {
+    BYADDR,
+    BYSIZE,
+    NUMINDEX
+  };
+
+typedef struct extent
+{
+  void* addr;
+  int size;
+  unsigned int prio;
+  struct extent* left[NUMINDEX];
+  struct extent* right[NUMINDEX];
+} extent_t;
+
+/* extents carved out of one node page (the first slot links the pages) */
+#define NODESPERPAGE (PAGESIZE / sizeof(extent_t) - 1)
+
 /************Global Variables*********************************************/
 
+static extent_t* root[NUMINDEX];
+
+// unused map nodes, and the pages they come from
+static extent_t* freenodes = NULL;
+static kpage_t* nodepages = NULL;
+static int livenodes = 0;
+
 /************Function Prototypes******************************************/
+static void* rm_malloc(kma_size_t);
+static void rm_free(void*, kma_size_t);
+static extent_t* node_alloc(void*, int);
+static void node_free(extent_t*);
+static int before(int, extent_t*, extent_t*);
+static void split(int, extent_t*, extent_t*, extent_t**, extent_t**);
+static extent_t* merge(int, extent_t*, extent_t*);
+static void insert(int, extent_t*);
+static void delete(int, extent_t*);
+static extent_t* best_fit(int);
+static void neighbours(void*, extent_t**, extent_t**);
 
 /************External Declaration*****************************************/
 
+static kma_ops_t rm_ops = { "rm", NULL, rm_malloc, rm_free, NULL, NULL };
+KMA_REGISTER(rm_ops)
+
 /**************Implementation***********************************************/
 
-void*
-kma_malloc(kma_size_t size)
+static void*
+rm_malloc(kma_size_t size)
+{
+  kpage_t* page;
+  extent_t* ext;
+  void* res;
+  
+  if (size > PAGESIZE)
+    { // does not fit in a page, take whole pages
+      if (size > (PAGESIZE << (MAXORDER - 1)))
+	{
+	  return NULL;
+	}
+      page = get_pages(get_order(size));
+      return page == NULL ? NULL : page->ptr;
+    }
+  
+  size = ALIGNUP(size);
+  
+  ext = best_fit(size);
+  if (ext == NULL)
+    { // nothing fits, map a new page
+      page = get_page();
+      if (page == NULL)
+	{
+	  return NULL;
+	}
+      ext = node_alloc(page->ptr, PAGESIZE);
+      if (ext == NULL)
+	{
+	  free_page(page);
+	  return NULL;
+	}
+      insert(BYADDR, ext);
+      insert(BYSIZE, ext);
+    }
+  
+  res = ext->addr;
+  delete(BYSIZE, ext);
+  if (ext->size == size)
+    {
+      delete(BYADDR, ext);
+      node_free(ext);
+    }
+  else
+    { // shrinking from the front keeps its place in the address index
+      ext->addr += size;
+      ext->size -= size;
+      insert(BYSIZE, ext);
+    }
+  
+  page_lookup(res)->count++;
+  return res;
+}
+
+static void
+rm_free(void* ptr, kma_size_t size)
+{
+  extent_t *prev, *next, *ext;
+  kpage_t* page;
+  
+  if (size > PAGESIZE)
+    { // served straight from the page buddy
+      free_pages(page_lookup(ptr));
+      return;
+    }
+  
+  size = ALIGNUP(size);
+  
+  neighbours(ptr, &prev, &next);
+  
+  // extents never span pages, so only merge within this one
+  if (prev != NULL
+      && (prev->addr + prev->size != ptr || BASEADDR(prev->addr) != BASEADDR(ptr)))
+    {
+      prev = NULL;
+    }
+  if (next != NULL
+      && (ptr + size != next->addr || BASEADDR(next->addr) != BASEADDR(ptr)))
+    {
+      next = NULL;
+    }
+  
+  if (prev != NULL && next != NULL)
+    {
+      delete(BYSIZE, prev);
+      delete(BYSIZE, next);
+      delete(BYADDR, next);
+      prev->size += size + next->size;
+      node_free(next);
+      ext = prev;
+    }
+  else if (prev != NULL)
+    {
+      delete(BYSIZE, prev);
+      prev->size += size;
+      ext = prev;
+    }
+  else if (next != NULL)
+    { // growing to the front keeps its place in the address index
+      delete(BYSIZE, next);
+      next->addr = ptr;
+      next->size += size;
+      ext = next;
+    }
+  else
+    {
+      ext = node_alloc(ptr, size);
+      assert(ext != NULL);
+      insert(BYADDR, ext);
+    }
+  insert(BYSIZE, ext);
+  
+  page = page_lookup(ptr);
+  if (--page->count == 0)
+    { // the whole page is one extent again, unmap it
+      assert(ext->size == PAGESIZE);
+      delete(BYSIZE, ext);
+      delete(BYADDR, ext);
+      node_free(ext);
+      free_page(page);
+    }
+}
+
+static extent_t*
+node_alloc(void* addr, int size)
+{
+  static unsigned int seed = 2463534242u;
+  extent_t* res;
+  
+  if (freenodes == NULL)
+    { // carve a new node page
+      kpage_t* page = get_page();
+      extent_t* nodes;
+      int i;
+      
+      if (page == NULL)
+	{
+	  return NULL;
+	}
+      *((kpage_t**)page->ptr) = nodepages;
+      nodepages = page;
+      
+      nodes = (extent_t*)page->ptr + 1;
+      for (i = 0; i < NODESPERPAGE; i++)
+	{
+	  nodes[i].left[BYADDR] = freenodes;
+	  freenodes = &nodes[i];
+	}
+    }
+  
+  res = freenodes;
+  freenodes = res->left[BYADDR];
+  livenodes++;
+  
+  // xorshift, random priorities keep the treaps balanced
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  
+  res->addr = addr;
+  res->size = size;
+  res->prio = seed;
+  res->left[BYADDR] = res->right[BYADDR] = NULL;
+  res->left[BYSIZE] = res->right[BYSIZE] = NULL;
+  
+  return res;
+}
+
+static void
+node_free(extent_t* ext)
 {
-  return NULL;
+  ext->left[BYADDR] = freenodes;
+  freenodes = ext;
+  
+  if (--livenodes == 0)
+    { // the map is empty, give the node pages back
+      while (nodepages != NULL)
+	{
+	  kpage_t* next = *((kpage_t**)nodepages->ptr);
+	  
+	  free_page(nodepages);
+	  nodepages = next;
+	}
+      freenodes = NULL;
+    }
 }
 
-void
-kma_free(void* ptr, kma_size_t size)
+/* whether a orders before b in the given index */
+static int
+before(int idx, extent_t* a, extent_t* b)
 {
-  ;
+  if (idx == BYSIZE && a->size != b->size)
+    {
+      return a->size < b->size;
+    }
+  return a->addr < b->addr;
 }
 
-#endif // KMA_RM
+/* splits a treap into the nodes before key and the rest */
+static void
+split(int idx, extent_t* t, extent_t* key, extent_t** l, extent_t** r)
+{
+  while (t != NULL)
+    {
+      if (before(idx, t, key))
+	{
+	  *l = t;
+	  l = &t->right[idx];
+	  t = t->right[idx];
+	}
+      else
+	{
+	  *r = t;
+	  r = &t->left[idx];
+	  t = t->left[idx];
+	}
+    }
+  *l = NULL;
+  *r = NULL;
+}
+
+/* joins two treaps where every node of a is before every node of b */
+static extent_t*
+merge(int idx, extent_t* a, extent_t* b)
+{
+  extent_t* res;
+  extent_t** link = &res;
+  
+  while (a != NULL && b != NULL)
+    {
+      if (a->prio > b->prio)
+	{
+	  *link = a;
+	  link = &a->right[idx];
+	  a = a->right[idx];
+	}
+      else
+	{
+	  *link = b;
+	  link = &b->left[idx];
+	  b = b->left[idx];
+	}
+    }
+  *link = (a != NULL) ? a : b;
+  
+  return res;
+}
+
+static void
+insert(int idx, extent_t* ext)
+{
+  extent_t** link = &root[idx];
+  
+  while (*link != NULL && (*link)->prio > ext->prio)
+    {
+      link = before(idx, ext, *link) ? &(*link)->left[idx] : &(*link)->right[idx];
+    }
+  
+  split(idx, *link, ext, &ext->left[idx], &ext->right[idx]);
+  *link = ext;
+}
+
+static void
+delete(int idx, extent_t* ext)
+{
+  extent_t** link = &root[idx];
+  
+  while (*link != ext)
+    {
+      assert(*link != NULL);
+      link = before(idx, ext, *link) ? &(*link)->left[idx] : &(*link)->right[idx];
+    }
+  
+  *link = merge(idx, ext->left[idx], ext->right[idx]);
+  ext->left[idx] = ext->right[idx] = NULL;
+}
+
+/* the smallest extent of at least size bytes, lowest address first */
+static extent_t*
+best_fit(int size)
+{
+  extent_t* t = root[BYSIZE];
+  extent_t* res = NULL;
+  
+  while (t != NULL)
+    {
+      if (t->size >= size)
+	{
+	  res = t;
+	  t = t->left[BYSIZE];
+	}
+      else
+	{
+	  t = t->right[BYSIZE];
+	}
+    }
+  
+  return res;
+}
+
+/* the free extents right below and above an address */
+static void
+neighbours(void* addr, extent_t** prev, extent_t** next)
+{
+  extent_t* t = root[BYADDR];
+  
+  *prev = NULL;
+  *next = NULL;
+  
+  while (t != NULL)
+    {
+      if (t->addr < addr)
+	{
+	  *prev = t;
+	  t = t->right[BYADDR];
+	}
+      else
+	{
+	  *next = t;
+	  t = t->left[BYADDR];
+	}
+    }
+}
@@ -0,0 +1,568 @@
+/***************************************************************************
+ *  Title: Kernel Memory Allocator
+ * -------------------------------------------------------------------------
+ *    Purpose: Kernel memory allocator with free lists sharded by page,
+ *             after mimalloc: every thread owns the pages it carves,
+ *             and every page keeps its own free lists
+ *    File: $RCSfile: kma_shard.c,v $
+ ***************************************************************************/
+#define __KMA_IMPL__
+
+/************System include***********************************************/
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <pthread.h>
+
+/************Private include**********************************************/
+#include "kpage.h"
+#include "kma.h"
+#include "kclass.h"
+#include "klist.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/*  The classes are the power-of-two ones of kma_bud.c, but instead of
+ *  one list per class threaded through blocks of any page, every page
+ *  holds blocks of a single class and three lists of its own:
+ *    free    the blocks malloc() takes, touched by the owner only
+ *    local   the blocks the owner freed, touched by the owner only
+ *    thread  the blocks other threads freed, pushed with a single CAS
+ *  A thread allocates from one page of a class, the first of its list,
+ *  until that page's free list runs dry. Only then are local and
+ *  thread lists collected, the latter with one atomic exchange for the
+ *  whole batch, and the first page that has blocks again takes over.
+ *  A page whose blocks have all come back is released, unless it is
+ *  the current one.
+ *
+ *  Pages found without any block are moved to a full list, so that
+ *  running dry does not scan them again and again. A free by the owner
+ *  moves its page back. A thread freeing into a full page of another
+ *  bumps the owner's pending count of the class, and the owner looks
+ *  through its full pages only when that count is set. Setting the
+ *  full flag and then checking the thread list, against pushing on
+ *  the thread list and then checking the flag, both sequentially
+ *  consistent, means one side always sees the other.
+ *
+ *  A thread that exits abandons the pages still in use; other threads
+ *  keep pushing on their thread lists, and the next thread short of a
+ *  page of that class adopts one. Heaps are kept for reuse until
+ *  teardown, so a stale owner read by a freeing thread stays valid.
+ */
+#define SHCLASSES (NUMCLASSES - 1)
+#define SHMAXSIZE (PAGESIZE / 2)
+
+typedef struct shheap shheap_t;
+
+/* one per page frame of the pool, in a table indexed by frame number */
+typedef struct
+{
+  klist_t link;      // in the owner's list of the class, or abandoned
+  void* start;       // the page
+  void* free;        // blocks linked through their first word
+  void* local;
+  void* thread;
+  shheap_t* owner;   // NULL while abandoned
+  int used;          // blocks handed out and not collected back
+  int cls;
+  int full;          // on the owner's full list
+} shpage_t;
+
+struct shheap
+{
+  klist_t pages[SHCLASSES];  // the pages of a class, current first
+  klist_t full[SHCLASSES];   // the pages that had no block left
+  int pending[SHCLASSES];    // frees by other threads into full pages
+  shheap_t* next;            // on the spare list
+};
+
+/************Global Variables*********************************************/
+
+static shpage_t* meta = NULL;
+static int nmeta = 0;
+
+/* this thread's pages, created on its first malloc() */
+static __thread shheap_t* heap = NULL;
+
+/* set in every thread with a heap, to abandon its pages on exit */
+static pthread_key_t heapkey;
+
+/* pages of exited threads, waiting for another owner, and their heaps */
+static klist_t abandoned[SHCLASSES];
+static shheap_t* spare = NULL;
+static pthread_mutex_t abandonedlock = PTHREAD_MUTEX_INITIALIZER;
+
+/* updated with atomics, on the slow path only */
+static struct
+{
+  long long carved;     // pages taken from the page layer
+  long long released;   // and given back
+  long long batches;    // non-empty thread lists collected
+  long long remote;     // blocks on them
+  long long abandoned;  // pages left by exiting threads
+  long long adopted;    // and taken over
+} shstats;
+
+/************Function Prototypes******************************************/
+static void shard_init();
+static void* shard_malloc(kma_size_t);
+static void shard_free(void*, kma_size_t);
+static void shard_stats();
+static void shard_teardown();
+static void shard_flush();
+static shheap_t* myheap();
+static shpage_t* nextpage(shheap_t*, int);
+static shpage_t* carve(shheap_t*, int);
+static shpage_t* adopt(shheap_t*, int);
+static void collect(shpage_t*);
+static void retire(shheap_t*, shpage_t*);
+static void revive(shheap_t*, shpage_t*);
+static void release(shpage_t*);
+static void abandon(void*);
+
+/************External Declaration*****************************************/
+
+static kma_ops_t shard_ops = { "shard", shard_init, shard_malloc, shard_free,
+			       shard_stats, shard_teardown, KMA_THREADSAFE,
+			       shard_flush };
+KMA_REGISTER(shard_ops)
+
+/**************Implementation***********************************************/
+
+static void
+shard_init()
+{
+  int cls;
+  
+  nmeta = page_capacity();
+  meta = mmap(NULL, (size_t) nmeta * sizeof(shpage_t), PROT_READ | PROT_WRITE,
+	      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (meta == MAP_FAILED)
+    error("Error using mmap to allocate the page table", "");
+  
+  for (cls = 0; cls < SHCLASSES; cls++)
+    {
+      klist_init(&abandoned[cls]);
+    }
+  memset(&shstats, 0, sizeof(shstats));
+  pthread_key_create(&heapkey, abandon);
+}
+
+static void
+shard_teardown()
+{
+  shheap_t* h;
+  
+  // the other threads have exited, and abandoned their pages, by now
+  shard_flush();
+  free(heap);
+  heap = NULL;
+  while ((h = spare) != NULL)
+    {
+      spare = h->next;
+      free(h);
+    }
+  pthread_key_delete(heapkey);
+  
+  munmap(meta, (size_t) nmeta * sizeof(shpage_t));
+  meta = NULL;
+  nmeta = 0;
+}
+
+static void*
+shard_malloc(kma_size_t size)
+{
+  shheap_t* h;
+  shpage_t* page;
+  void* res;
+  int cls;
+  
+  if (size > SHMAXSIZE)
+    { // too large for a block, hand out whole pages
+      kpage_t* pages;
+  
+      if (size > (PAGESIZE << (MAXORDER - 1)))
+	{
+	  return NULL;
+	}
+      pages = get_pages(get_order(size));
+      return pages == NULL ? NULL : pages->ptr;
+    }
+  
+  cls = size_class(size);
+  h = myheap();
+  page = (shpage_t*) h->pages[cls].next;
+  if (klist_empty(&h->pages[cls]) || page->free == NULL)
+    {
+      page = nextpage(h, cls);
+      if (page == NULL)
+	{
+	  return NULL;
+	}
+    }
+  
+  res = page->free;
+  page->free = *(void**)res;
+  page->used++;
+  return res;
+}
+
+static void
+shard_free(void* ptr, kma_size_t size)
+{
+  shpage_t* page;
+  void* head;
+  
+  if (size > SHMAXSIZE)
+    { // served straight from the page buddy
+      free_pages(page_lookup(ptr));
+      return;
+    }
+  
+  page = &meta[page_frame(ptr)];
+  if (heap != NULL && __atomic_load_n(&page->owner, __ATOMIC_RELAXED) == heap)
+    {
+      *(void**)ptr = page->local;
+      page->local = ptr;
+      if (page->full)
+	{
+	  revive(heap, page);
+	}
+      if (--page->used == 0 && heap->pages[page->cls].next != &page->link)
+	{
+	  release(page);
+	}
+      return;
+    }
+  
+  // another thread's page, or nobody's: the owner collects it later
+  head = __atomic_load_n(&page->thread, __ATOMIC_RELAXED);
+  do
+    {
+      *(void**)ptr = head;
+    }
+  while (!__atomic_compare_exchange_n(&page->thread, &head, ptr, TRUE,
+				      __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+  
+  if (__atomic_load_n(&page->full, __ATOMIC_SEQ_CST))
+    {
+      shheap_t* owner = __atomic_load_n(&page->owner, __ATOMIC_RELAXED);
+      
+      if (owner != NULL)
+	{
+	  __atomic_fetch_add(&owner->pending[page->cls], 1, __ATOMIC_RELEASE);
+	}
+    }
+}
+
+static void
+shard_stats()
+{
+  printf("Shards: %lld pages carved, %lld released, %lld abandoned, "
+	 "%lld adopted; %lld remote frees collected in %lld batches\n",
+	 shstats.carved, shstats.released, shstats.abandoned, shstats.adopted,
+	 shstats.remote, shstats.batches);
+}
+
+/* takes over the abandoned pages, then gives back every page of this
+ * thread that has all its blocks back */
+static void
+shard_flush()
+{
+  shheap_t* h = myheap();
+  klist_t* node;
+  klist_t* next;
+  shpage_t* page;
+  int cls;
+  
+  for (cls = 0; cls < SHCLASSES; cls++)
+    {
+      while (adopt(h, cls) != NULL)
+	{
+	}
+      for (node = h->full[cls].next; node != &h->full[cls]; node = next)
+	{
+	  next = node->next;
+	  revive(h, (shpage_t*) node);
+	}
+      for (node = h->pages[cls].next; node != &h->pages[cls]; node = next)
+	{
+	  next = node->next;
+	  page = (shpage_t*) node;
+	  collect(page);
+	  if (page->used == 0)
+	    {
+	      release(page);
+	    }
+	}
+    }
+}
+
+static shheap_t*
+myheap()
+{
+  int cls;
+  
+  if (heap != NULL)
+    {
+      return heap;
+    }
+  
+  pthread_mutex_lock(&abandonedlock);
+  heap = spare;
+  if (heap != NULL)
+    {
+      spare = heap->next;
+    }
+  pthread_mutex_unlock(&abandonedlock);
+  if (heap == NULL)
+    {
+      heap = malloc(sizeof(shheap_t));
+      assert(heap != NULL);
+    }
+  
+  for (cls = 0; cls < SHCLASSES; cls++)
+    {
+      klist_init(&heap->pages[cls]);
+      klist_init(&heap->full[cls]);
+      heap->pending[cls] = 0;
+    }
+  pthread_setspecific(heapkey, heap);
+  return heap;
+}
+
+/* the current page ran dry: makes the first page that has blocks after
+ * collecting current, retiring those that have none, then looks at
+ * the full pages others freed into, then adopts or carves a page */
+static shpage_t*
+nextpage(shheap_t* h, int cls)
+{
+  klist_t* head = &h->pages[cls];
+  klist_t* node;
+  klist_t* next;
+  shpage_t* page;
+  
+  if (__atomic_load_n(&h->pending[cls], __ATOMIC_RELAXED) > 0)
+    { // these are in use, so their thread lists go first
+      __atomic_exchange_n(&h->pending[cls], 0, __ATOMIC_ACQUIRE);
+      for (node = h->full[cls].next; node != &h->full[cls]; node = next)
+	{
+	  next = node->next;
+	  if (__atomic_load_n(&((shpage_t*) node)->thread, __ATOMIC_RELAXED))
+	    {
+	      revive(h, (shpage_t*) node);
+	    }
+	}
+    }
+  
+  for (node = head->next; node != head; node = next)
+    {
+      next = node->next;
+      page = (shpage_t*) node;
+      collect(page);
+      if (page->free != NULL)
+	{
+	  klist_del(node);
+	  klist_add(head, node);
+	  return page;
+	}
+      retire(h, page);
+    }
+  
+  // adopted pages are added at the end of the list
+  while ((page = adopt(h, cls)) != NULL)
+    {
+      if (page->free != NULL)
+	{
+	  klist_del(&page->link);
+	  klist_add(head, &page->link);
+	  return page;
+	}
+      retire(h, page);
+    }
+  
+  return carve(h, cls);
+}
+
+/* takes a new page from the page layer and makes it current */
+static shpage_t*
+carve(shheap_t* h, int cls)
+{
+  kpage_t* kpage = get_page();
+  shpage_t* page;
+  int i, n;
+  
+  if (kpage == NULL)
+    {
+      return NULL;
+    }
+  __atomic_fetch_add(&shstats.carved, 1, __ATOMIC_RELAXED);
+  
+  page = &meta[page_frame(kpage->ptr)];
+  page->start = kpage->ptr;
+  page->local = NULL;
+  page->thread = NULL;
+  page->used = 0;
+  page->cls = cls;
+  page->full = FALSE;
+  __atomic_store_n(&page->owner, h, __ATOMIC_RELAXED);
+  
+  // linked in address order
+  n = PAGESIZE / CLASSSIZE(cls);
+  for (i = 0; i < n - 1; i++)
+    {
+      *(void**)(kpage->ptr + i * CLASSSIZE(cls)) =
+	kpage->ptr + (i + 1) * CLASSSIZE(cls);
+    }
+  *(void**)(kpage->ptr + (n - 1) * CLASSSIZE(cls)) = NULL;
+  page->free = kpage->ptr;
+  
+  klist_add(&h->pages[cls], &page->link);
+  return page;
+}
+
+/* takes over an abandoned page of a class, collected and put at the end
+ * of the list, or releases it if it has all its blocks back */
+static shpage_t*
+adopt(shheap_t* h, int cls)
+{
+  shpage_t* page;
+  
+  for (;;)
+    {
+      pthread_mutex_lock(&abandonedlock);
+      if (klist_empty(&abandoned[cls]))
+	{
+	  pthread_mutex_unlock(&abandonedlock);
+	  return NULL;
+	}
+      page = (shpage_t*) klist_pop(&abandoned[cls]);
+      pthread_mutex_unlock(&abandonedlock);
+  
+      __atomic_fetch_add(&shstats.adopted, 1, __ATOMIC_RELAXED);
+      __atomic_store_n(&page->owner, h, __ATOMIC_RELAXED);
+      klist_add(h->pages[cls].prev, &page->link);
+      collect(page);
+      if (page->used > 0)
+	{
+	  return page;
+	}
+      release(page);
+    }
+}
+
+/* moves the local and thread lists of a page to its free list */
+static void
+collect(shpage_t* page)
+{
+  void* list;
+  void* tail;
+  int n;
+  
+  if (page->local != NULL)
+    {
+      for (tail = page->local; *(void**)tail != NULL; tail = *(void**)tail)
+	{
+	}
+      *(void**)tail = page->free;
+      page->free = page->local;
+      page->local = NULL;
+    }
+  
+  if (__atomic_load_n(&page->thread, __ATOMIC_RELAXED) == NULL)
+    {
+      return;
+    }
+  list = __atomic_exchange_n(&page->thread, NULL, __ATOMIC_ACQUIRE);
+  for (n = 1, tail = list; *(void**)tail != NULL; n++, tail = *(void**)tail)
+    {
+    }
+  *(void**)tail = page->free;
+  page->free = list;
+  page->used -= n;
+  
+  __atomic_fetch_add(&shstats.batches, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&shstats.remote, n, __ATOMIC_RELAXED);
+}
+
+/* moves a page without blocks to the full list, or keeps it where it is
+ * if another thread freed into it meanwhile */
+static void
+retire(shheap_t* h, shpage_t* page)
+{
+  klist_del(&page->link);
+  klist_add(&h->full[page->cls], &page->link);
+  __atomic_store_n(&page->full, TRUE, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&page->thread, __ATOMIC_SEQ_CST) != NULL)
+    {
+      revive(h, page);
+    }
+}
+
+/* moves a page from the full list to the end of the list of its class */
+static void
+revive(shheap_t* h, shpage_t* page)
+{
+  __atomic_store_n(&page->full, FALSE, __ATOMIC_RELAXED);
+  klist_del(&page->link);
+  klist_add(h->pages[page->cls].prev, &page->link);
+}
+
+/* gives a page with all its blocks back to the page layer */
+static void
+release(shpage_t* page)
+{
+  assert(page->used == 0);
+  
+  __atomic_fetch_add(&shstats.released, 1, __ATOMIC_RELAXED);
+  klist_del(&page->link);
+  free_page(page_lookup(page->start));
+}
+
+/* the thread exits: pages still in use go to the abandoned lists, and
+ * the heap to the spare ones */
+static void
+abandon(void* arg)
+{
+  shheap_t* h = arg;
+  shpage_t* page;
+  int cls;
+  
+  for (cls = 0; cls < SHCLASSES; cls++)
+    {
+      while (!klist_empty(&h->full[cls]))
+	{
+	  revive(h, (shpage_t*) h->full[cls].next);
+	}
+      while (!klist_empty(&h->pages[cls]))
+	{
+	  page = (shpage_t*) h->pages[cls].next;
+	  collect(page);
+	  if (page->used == 0)
+	    {
+	      release(page);
+	      continue;
+	    }
+	  
+	  __atomic_fetch_add(&shstats.abandoned, 1, __ATOMIC_RELAXED);
+	  klist_del(&page->link);
+	  __atomic_store_n(&page->owner, NULL, __ATOMIC_RELAXED);
+	  pthread_mutex_lock(&abandonedlock);
+	  klist_add(&abandoned[cls], &page->link);
+	  pthread_mutex_unlock(&abandonedlock);
+	}
+    }
+  
+  pthread_mutex_lock(&abandonedlock);
+  h->next = spare;
+  spare = h;
+  pthread_mutex_unlock(&abandonedlock);
+  heap = NULL;
+}
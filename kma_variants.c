@@ -0,0 +1,51 @@
+/***************************************************************************
+ *  Title: Kernel Memory Allocator
+ * -------------------------------------------------------------------------
+ *    Purpose: Variants of the segregated-fit allocator built from the
+ *             policies in kpolicy.h
+ *    File: $RCSfile: kma_variants.c,v $
+ ***************************************************************************/
+#define __KMA_IMPL__
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/************Private include**********************************************/
+
+/*  mck2 with the fine classes: four per doubling above 128 bytes cut the
+ *  internal fragmentation of the power-of-two classes roughly in half
+ */
+#define KP_NAME fine
+#define KP_CLASSES KP_FINE
+#define KP_META KP_META_TABLE
+#include "kpolicy.h"
+
+/*  mck2 carving four-page slabs: fewer refills and less tail waste for
+ *  the big classes, at the price of holding more memory per class
+ */
+#define KP_NAME slab4
+#define KP_CLASSES KP_POW2
+#define KP_SLAB 2
+#define KP_META KP_META_TABLE
+#include "kpolicy.h"
+
+/*  mck2 behind a mutex, to price the locking on its own */
+#define KP_NAME mck2_mt
+#define KP_CLASSES KP_POW2
+#define KP_META KP_META_TABLE
+#define KP_LOCK KP_LOCK_MUTEX
+#include "kpolicy.h"
+
+/*  mck2_mt with a per-thread cache of up to 64 blocks per class in
+ *  front of the locked lists
+ */
+#define KP_NAME mck2_tc
+#define KP_CLASSES KP_POW2
+#define KP_META KP_META_TABLE
+#define KP_LOCK KP_LOCK_MUTEX
+#define KP_TCACHE 64
+#include "kpolicy.h"
@@ -67,8 +67,13 @@
 #endif
 
 #define PAGESIZE 8192
+#define PAGESHIFT 13
 
-#define MAXPAGES 4096
+/* default pool capacity in pages, see page_setmax() */
+#define DEFMAXPAGES (1 << 22)
+
+/* get_pages() serves blocks of 2^0 .. 2^(MAXORDER-1) contiguous pages */
+#define MAXORDER 11
 
 /***********************************************************************
  *  Title: Base Address Macro
@@ -78,27 +83,41 @@
  *    Input: pointer
  *    Output: the base address of the page
  ***********************************************************************/
-#define BASEADDR(x) ((void*)(((int) (x)) & ~(PAGESIZE-1)))
+#define BASEADDR(x) ((void*)(((unsigned long) (x)) & ~(PAGESIZE-1)))
 
 typedef struct
 {
-  int id;
+  int id;     // frame number of the block, unique among live blocks
   void* ptr;
   int size;
+  int count;  // free for the allocator, e.g. live objects on the page
 } kpage_t;
 
 typedef struct
 {
   int num_requested;
   int num_freed;
-  int num_in_use;
+  int num_in_use;  // in page_stats() copies; live, see pages_in_use()
   int page_size;
+  int num_peak;  // most pages in use at once since the pool was built
 } kpage_stat_t;
 
 /************Global Variables*********************************************/
 
+/*  The live page statistics, read-only and updated atomically. Reading
+ *  them through the accessors below costs a load or two, so they can be
+ *  sampled between allocator calls without disturbing the timing;
+ *  page_stats() copies them for callers that want a snapshot.
+ */
+EXTERN const kpage_stat_t* const gpagestats;
+
 /************Function Prototypes******************************************/
 
+/*  Pages may be taken, freed and looked up from several threads at
+ *  once, and a block freed by another thread than the one it went to.
+ *  page_setmax() and page_teardown() need the pool to themselves.
+ */
+
 /***********************************************************************
  *  Title: Allocates a memory page
  * ---------------------------------------------------------------------
@@ -117,6 +136,91 @@ EXTERN kpage_t* get_page();
  ***********************************************************************/
 EXTERN void free_page(kpage_t*);
 
+/***********************************************************************
+ *  Title: Allocates contiguous memory pages
+ * ---------------------------------------------------------------------
+ *    Purpose: Allocates a block of 2^order physically adjacent pages
+ *             from the page-level buddy
+ *    Input: the order of the block (0 <= order < MAXORDER)
+ *    Output: the page structure of the first page of the block, or
+ *            NULL once the pool capacity is exhausted
+ ***********************************************************************/
+EXTERN kpage_t* get_pages(int);
+
+/***********************************************************************
+ *  Title: Releases contiguous memory pages
+ * ---------------------------------------------------------------------
+ *    Purpose: Releases a block returned by get_pages() (or get_page())
+ *             and merges it with its free buddies
+ *    Input: the pointer to the memory page structure
+ *    Output: none
+ ***********************************************************************/
+EXTERN void free_pages(kpage_t*);
+
+/***********************************************************************
+ *  Title: Block order of a size
+ * ---------------------------------------------------------------------
+ *    Purpose: Computes the smallest order whose block holds size bytes
+ *    Input: the size in bytes
+ *    Output: the order to pass to get_pages()
+ ***********************************************************************/
+EXTERN int get_order(int);
+
+/***********************************************************************
+ *  Title: Looks up a memory page
+ * ---------------------------------------------------------------------
+ *    Purpose: Finds the page structure of an allocated block in
+ *             constant time
+ *    Input: any pointer into the allocated block
+ *    Output: the memory page structure of the block
+ ***********************************************************************/
+EXTERN kpage_t* page_lookup(void*);
+
+/***********************************************************************
+ *  Title: Frame number of a page
+ * ---------------------------------------------------------------------
+ *    Purpose: Gives the number of the page within the pool, for
+ *             allocators that keep per-page tables of their own
+ *    Input: any pointer into an allocated page
+ *    Output: the frame number, below page_capacity()
+ ***********************************************************************/
+EXTERN int page_frame(void*);
+
+/***********************************************************************
+ *  Title: Pool capacity
+ * ---------------------------------------------------------------------
+ *    Purpose: Gives the number of pages the pool can hold, building
+ *             the pool if needed
+ *    Input: none
+ *    Output: the capacity in pages
+ ***********************************************************************/
+EXTERN int page_capacity();
+
+/***********************************************************************
+ *  Title: Sets the pool capacity
+ * ---------------------------------------------------------------------
+ *    Purpose: Sets how many pages of address space the pool reserves.
+ *             Only reserved pages that are handed out get committed,
+ *             so a large capacity costs no memory. Must be called
+ *             before the pool is built or after page_teardown(); the
+ *             KMA_MAXPAGES environment variable overrides it.
+ *    Input: the capacity in pages
+ *    Output: none
+ ***********************************************************************/
+EXTERN void page_setmax(int);
+
+/***********************************************************************
+ *  Title: Tears down the page pool
+ * ---------------------------------------------------------------------
+ *    Purpose: Unmaps the pool and the frame table. The pool is kept
+ *             even when every page is free, so this is the only way
+ *             to give it back; the next get_pages() builds a new one.
+ *             The page statistics start over with it.
+ *    Input: none
+ *    Output: none
+ ***********************************************************************/
+EXTERN void page_teardown();
+
 /***********************************************************************
  *  Title: Memory page statistics
  * ---------------------------------------------------------------------
@@ -126,6 +230,34 @@ EXTERN void free_page(kpage_t*);
  ***********************************************************************/
 EXTERN kpage_stat_t* page_stats();
 
+/***********************************************************************
+ *  Title: Live page counters
+ * ---------------------------------------------------------------------
+ *    Purpose: Read single counters of gpagestats without a copy
+ *    Input: none
+ *    Output: pages in use, their high-water mark, bytes in use
+ ***********************************************************************/
+static inline int
+pages_in_use()
+{
+  // freed first: every free it counts then has its request counted
+  int freed = __atomic_load_n(&gpagestats->num_freed, __ATOMIC_ACQUIRE);
+  
+  return __atomic_load_n(&gpagestats->num_requested, __ATOMIC_RELAXED) - freed;
+}
+
+static inline int
+pages_peak()
+{
+  return __atomic_load_n(&gpagestats->num_peak, __ATOMIC_RELAXED);
+}
+
+static inline long long
+page_bytes_in_use()
+{
+  return (long long) pages_in_use() * PAGESIZE;
+}
+
 /************External Declaration*****************************************/
 
 /**************Definition***************************************************/
@@ -0,0 +1,157 @@
+/***************************************************************************
+ *  Title: Allocator Registry
+ * -------------------------------------------------------------------------
+ *    Purpose: Keeps the registered kernel memory allocators and routes
+ *             kma_malloc() and kma_free() to the selected one
+ *    File: $RCSfile: kregistry.c,v $
+ ***************************************************************************/
+#define __KMA_IMPL__
+
+/************System include***********************************************/
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+/************Private include**********************************************/
+#include "kpage.h"
+#include "kma.h"
+#include "kmag.h"
+#include "kpcpu.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/************Global Variables*********************************************/
+
+kma_ops_t* gkma = NULL;
+
+static kma_ops_t* registry[MAXALLOCATORS];
+static int nregistered = 0;
+
+/* layers that kma_find() stacks on an allocator named before the suffix */
+static const struct
+{
+  char* suffix;
+  kma_ops_t* (*wrap)(kma_ops_t*);
+} layers[] = {
+  { MAGSUFFIX,    kmag_wrap },
+  { PCPUSUFFIX,   kpcpu_wrap },
+  { TCACHESUFFIX, kpcpu_wrap_thread },
+};
+
+/************Function Prototypes******************************************/
+static kma_ops_t* lookup(char*);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+void*
+kma_malloc(kma_size_t size)
+{
+  return gkma->malloc(size);
+}
+
+void
+kma_free(void* ptr, kma_size_t size)
+{
+  gkma->free(ptr, size);
+}
+
+void
+kma_register(kma_ops_t* ops)
+{
+  assert(nregistered < MAXALLOCATORS);
+  assert(lookup(ops->name) == NULL);
+  
+  registry[nregistered++] = ops;
+}
+
+int
+kma_count()
+{
+  return nregistered;
+}
+
+kma_ops_t*
+kma_get(int i)
+{
+  if (i < 0 || i >= nregistered)
+    {
+      return NULL;
+    }
+  return registry[i];
+}
+
+kma_ops_t*
+kma_find(char* name)
+{
+  kma_ops_t* ops = lookup(name);
+  char* basename;
+  int i, n;
+  
+  for (i = 0; ops == NULL && i < sizeof(layers) / sizeof(layers[0]); i++)
+    {
+      n = strlen(name) - strlen(layers[i].suffix);
+      if (n <= 0 || strcmp(name + n, layers[i].suffix) != 0)
+	{
+	  continue;
+	}
+      
+      // built the first time it is asked for, on top of whatever the
+      // rest of the name finds
+      basename = strndup(name, n);
+      assert(basename != NULL);
+      ops = kma_find(basename);
+      free(basename);
+      if (ops != NULL)
+	{
+	  ops = nregistered < MAXALLOCATORS ? layers[i].wrap(ops) : NULL;
+	}
+    }
+  return ops;
+}
+
+void
+kma_use(kma_ops_t* ops)
+{
+  assert(ops != NULL);
+  
+  gkma = ops;
+  if (ops->init != NULL)
+    {
+      ops->init();
+    }
+}
+
+void
+kma_done()
+{
+  assert(gkma != NULL);
+  
+  if (gkma->teardown != NULL)
+    {
+      gkma->teardown();
+    }
+  page_teardown();
+  gkma = NULL;
+}
+
+static kma_ops_t*
+lookup(char* name)
+{
+  int i;
+  
+  for (i = 0; i < nregistered; i++)
+    {
+      if (strcmp(registry[i]->name, name) == 0)
+	{
+	  return registry[i];
+	}
+    }
+  return NULL;
+}
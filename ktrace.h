@@ -0,0 +1,112 @@
+/***************************************************************************
+ *  Title: Traces
+ * -------------------------------------------------------------------------
+ *    Purpose: Loads allocation traces, text or binary, into an array of
+ *             fixed-width op records the harness replays directly
+ *    File: $RCSfile: ktrace.h,v $
+ ***************************************************************************/
+
+#ifndef __KTRACE_H__
+#define __KTRACE_H__
+
+/************System include***********************************************/
+#include <stdio.h>
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __KTRACE_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/*  A binary trace is a header followed by n_ops records, in host byte
+ *  order. The records are exactly what the harness replays, so a binary
+ *  trace is mapped and used in place; a text trace is parsed into the
+ *  same records once, before any allocator runs.
+ *
+ *  Every op belongs to one of n_threads streams. Version 1 traces
+ *  predate the streams; their records are read as stream 0, which they
+ *  are bit for bit since no size there reaches 2^24. In a text trace
+ *  "THREAD t" puts the ops that follow it in stream t.
+ */
+#define TRACEMAGIC 0x5452414b  // "KART" read little-endian
+#define TRACEVERSION 2
+
+typedef struct
+{
+  unsigned int magic;
+  unsigned int version;
+  unsigned int n_req;          // ids run from 0 to n_req - 1
+  unsigned int n_threads;      // streams run from 0 to n_threads - 1
+  unsigned long long n_ops;
+} ktrace_hdr_t;
+
+/*  one REQUEST or FREE of stream tid; size 0 frees id, text sizes are
+ *  always positive and, at twice the largest block kpage hands out,
+ *  MAXOPSIZE leaves the top byte of the word to the stream
+ */
+typedef struct
+{
+  unsigned int id;
+  unsigned int size : 24;
+  unsigned int tid : 8;
+} ktrace_op_t;
+
+#define OPFREE 0
+#define MAXOPSIZE ((1 << 24) - 1)
+#define MAXSTREAMS 256
+
+typedef struct
+{
+  ktrace_hdr_t hdr;
+  ktrace_op_t* ops;
+  void* map;                   // the mapping of a binary trace, or NULL
+  size_t maplen;
+} ktrace_t;
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Opens a trace
+ * ---------------------------------------------------------------------
+ *    Purpose: Maps a binary trace read-only, or parses a text trace
+ *             into records; the kind is told by the magic number
+ *    Input: the file name, the trace to fill in
+ *    Output: none, errors are fatal
+ ***********************************************************************/
+EXTERN void trace_open(char*, ktrace_t*);
+
+/***********************************************************************
+ *  Title: Closes a trace
+ * ---------------------------------------------------------------------
+ *    Purpose: Unmaps or frees the records of a trace
+ *    Input: the trace
+ *    Output: none
+ ***********************************************************************/
+EXTERN void trace_close(ktrace_t*);
+
+/***********************************************************************
+ *  Title: Writes a binary trace
+ * ---------------------------------------------------------------------
+ *    Purpose: Stores the records of a trace in the binary format
+ *    Input: the output stream, the trace
+ *    Output: none, errors are fatal
+ ***********************************************************************/
+EXTERN void trace_write(FILE*, ktrace_t*);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __KTRACE_H__ */
@@ -0,0 +1,648 @@
+/***************************************************************************
+ *  Title: Trace Generator
+ * -------------------------------------------------------------------------
+ *    Purpose: Streams seeded, reproducible allocation traces, text or
+ *             binary, from a size model and a lifetime model
+ *    File: $RCSfile: gentrace.c,v $
+ ***************************************************************************/
+
+/************System include***********************************************/
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+/************Private include**********************************************/
+#include "ktrace.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/*  Time is counted in allocations: request i is made at step i and its
+ *  lifetime model picks the step it dies at. A 4-ary heap keyed on
+ *  death step, then id, holds the live requests; before request i
+ *  every request due by step i is freed, and whatever is still live
+ *  after the last request is freed in order of death. Nothing is ever
+ *  inserted in the middle of the trace, so it streams out in
+ *  O(n log live).
+ *
+ *  With several threads every request is made by one picked at random
+ *  and freed by the same one, or by another with probability cross.
+ *  With a producer, thread 0 makes every request and the others free
+ *  them all, so they never allocate at all.
+ */
+enum SIZES
+  {
+    SLOG,        // log-uniform in [min, max]
+    SLINEAR,     // uniform in [min, max]
+    SZIPF,       // a few distinct sizes with Zipfian popularity
+    SBIMODAL,    // mostly small sizes with a band of large ones
+    SSPIKE       // one size makes up a fixed share of the requests
+  };
+
+enum LIFETIMES
+  {
+    LUNIFORM,    // dies uniformly anywhere in the rest of the trace
+    LEARLY,      // 90% die within the next 10% of the trace
+    LFIFO,       // producer-consumer: dies exactly depth requests later
+    LEXP         // exponentially distributed with a given mean
+  };
+
+#define OUTBUF (1 << 16)
+
+/*  The heap key packs the death step above the 31-bit id, so one
+ *  compare orders by death and breaks ties by age; NEVER is the last
+ *  step a key can hold and means freed only at the very end.
+ */
+#define IDBITS 31
+#define NEVER ((1ULL << (64 - IDBITS)) - 1)
+#define KEY(death, id) (((unsigned long long) (death) << IDBITS) | (id))
+#define DEATH(key) ((key) >> IDBITS)
+#define ID(key) ((unsigned int) ((key) & ((1ULL << IDBITS) - 1)))
+
+typedef struct
+{
+  unsigned long long key;
+  unsigned int size;
+  unsigned int tid;            // the thread that frees it
+} live_t;
+
+/************Global Variables*********************************************/
+
+/* xoshiro256** state */
+static unsigned long long rng[4];
+
+/* model parameters, see usage() */
+static int sizes = SLOG, lifetimes = LUNIFORM;
+static int minsize, maxsize;
+static int zipfsizes = 64;
+static double zipfexp = 1.0;
+static double share = -1;
+static int spikesize = 0;
+static int depth = 1000;
+static double mean = 1000;
+static int phases = 1;
+static double longlived = 0;
+static int threads = 1;
+static double cross = 0.25;
+static int producer = 0;
+
+/* sizes of the current phase */
+static double lo, hi;
+static int* zipfsize;
+static double* zipfcdf;
+
+/* live requests, a 4-ary min-heap on key */
+static live_t* heap;
+static int nlive = 0, heapcap = 0;
+
+/* output */
+static FILE* out;
+static int binary = 0;
+static char obuf[OUTBUF];
+static int olen = 0;
+static int curtid = 0;
+static long long bytes = 0, maxbytes = 0;
+
+/************Function Prototypes******************************************/
+static unsigned long long next();
+static double uniform();
+static int draw_size();
+static unsigned long long draw_death(unsigned long long, unsigned long long,
+				     unsigned long long);
+static void phase(int);
+static void push(live_t);
+static live_t pop();
+static int draw_tid(int);
+static void emit(unsigned int, unsigned int, int);
+static void flush();
+static void usage(char*);
+void error(char*, char*);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+int
+main(int argc, char* argv[])
+{
+  unsigned long long count, i, end, seed = 1, z;
+  char* sizename;
+  char* lifename;
+  int c, k;
+  
+  while ((c = getopt(argc, argv, "r:bz:e:f:k:q:m:p:l:t:x:o")) != -1)
+    {
+      switch (c)
+	{
+	case 'r':
+	  seed = strtoull(optarg, NULL, 0);
+	  break;
+	case 'b':
+	  binary = 1;
+	  break;
+	case 'z':
+	  zipfsizes = atoi(optarg);
+	  break;
+	case 'e':
+	  zipfexp = atof(optarg);
+	  break;
+	case 'f':
+	  share = atof(optarg);
+	  break;
+	case 'k':
+	  spikesize = atoi(optarg);
+	  break;
+	case 'q':
+	  depth = atoi(optarg);
+	  break;
+	case 'm':
+	  mean = atof(optarg);
+	  break;
+	case 'p':
+	  phases = atoi(optarg);
+	  break;
+	case 'l':
+	  longlived = atof(optarg);
+	  break;
+	case 't':
+	  threads = atoi(optarg);
+	  break;
+	case 'x':
+	  cross = atof(optarg);
+	  break;
+	case 'o':
+	  producer = 1;
+	  break;
+	default:
+	  usage(argv[0]);
+	}
+    }
+  
+  if (argc - optind != 6)
+    {
+      usage(argv[0]);
+    }
+  
+  count = strtoull(argv[optind], NULL, 0);
+  sizename = argv[optind + 1];
+  minsize = atoi(argv[optind + 2]);
+  maxsize = atoi(argv[optind + 3]);
+  lifename = argv[optind + 4];
+  
+  if (strcmp(sizename, "log") == 0)
+    sizes = SLOG;
+  else if (strcmp(sizename, "linear") == 0)
+    sizes = SLINEAR;
+  else if (strcmp(sizename, "zipf") == 0)
+    sizes = SZIPF;
+  else if (strcmp(sizename, "bimodal") == 0)
+    sizes = SBIMODAL;
+  else if (strcmp(sizename, "spike") == 0)
+    sizes = SSPIKE;
+  else
+    error("invalid allocation size distribution", sizename);
+  
+  if (strcmp(lifename, "uniform") == 0)
+    lifetimes = LUNIFORM;
+  else if (strcmp(lifename, "early") == 0)
+    lifetimes = LEARLY;
+  else if (strcmp(lifename, "fifo") == 0)
+    lifetimes = LFIFO;
+  else if (strcmp(lifename, "exp") == 0)
+    lifetimes = LEXP;
+  else
+    error("invalid deallocation policy", lifename);
+  
+  if (count == 0 || count > 0x7fffffffULL || minsize < 1 || maxsize < minsize
+      || maxsize > MAXOPSIZE || threads < 1 || threads > MAXSTREAMS
+      || cross < 0 || cross > 1 || zipfsizes < 1 || depth < 1 || mean < 1 || phases < 1
+      || (unsigned long long) phases > count || longlived < 0
+      || longlived > 1 || share > 1 || (producer && threads < 2))
+    {
+      usage(argv[0]);
+    }
+  
+  if (share < 0)
+    {
+      share = sizes == SBIMODAL ? 0.8 : 0.5;
+    }
+  if (spikesize == 0)
+    {
+      spikesize = (int) sqrt((double) minsize * maxsize);
+    }
+  
+  // splitmix64 spreads the seed over the whole state
+  z = seed;
+  for (k = 0; k < 4; k++)
+    {
+      z += 0x9e3779b97f4a7c15ULL;
+      rng[k] = z;
+      rng[k] = (rng[k] ^ (rng[k] >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      rng[k] = (rng[k] ^ (rng[k] >> 27)) * 0x94d049bb133111ebULL;
+      rng[k] ^= rng[k] >> 31;
+    }
+  
+  zipfsize = malloc(zipfsizes * sizeof(int));
+  zipfcdf = malloc(zipfsizes * sizeof(double));
+  assert(zipfsize != NULL && zipfcdf != NULL);
+  
+  out = fopen(argv[optind + 5], "w");
+  if (out == NULL)
+    {
+      error("unable to open output file", argv[optind + 5]);
+    }
+  
+  if (binary)
+    {
+      ktrace_hdr_t hdr = { TRACEMAGIC, TRACEVERSION, count, threads,
+			   2 * count };
+  
+      fwrite(&hdr, sizeof(hdr), 1, out);
+    }
+  else
+    { // as in the testsuite traces, the count is that of the lines
+      olen = sprintf(obuf, "%llu\n", 2 * count);
+    }
+  
+  for (k = 0, i = 0; k < phases; k++)
+    {
+      phase(k);
+      end = phases == 1 ? NEVER : count * (k + 1) / phases;
+  
+      for (; i < count * (k + 1) / phases; i++)
+	{
+	  live_t req;
+	  int tid;
+  
+	  while (nlive > 0 && DEATH(heap[0].key) <= i)
+	    {
+	      req = pop();
+	      emit(ID(req.key), OPFREE, req.tid);
+	    }
+  
+	  req.size = draw_size();
+	  req.key = KEY(uniform() < longlived ? NEVER : draw_death(i, count, end),
+			i);
+	  tid = draw_tid(-1);
+	  req.tid = draw_tid(tid);
+	  emit(i, req.size, tid);
+	  push(req);
+	}
+    }
+  
+  while (nlive > 0)
+    {
+      live_t req = pop();
+  
+      emit(ID(req.key), OPFREE, req.tid);
+    }
+  
+  flush();
+  if (fclose(out) != 0)
+    {
+      error("unable to write output file", argv[optind + 5]);
+    }
+  
+  printf("%llu allocations, %llu deallocations\n", count, count);
+  printf("Maximum bytes allocated: %lld\n", maxbytes);
+  
+  return 0;
+}
+
+void
+error(char* message, char* arg)
+{
+  fprintf(stderr, "ERROR: %s: %s.\n", message, arg);
+  exit(-1);
+}
+
+/* xoshiro256**, fast and good enough for any model here */
+static unsigned long long
+next()
+{
+  unsigned long long res = rng[1] * 5, t = rng[1] << 17;
+  
+  res = ((res << 7) | (res >> 57)) * 9;
+  rng[2] ^= rng[0];
+  rng[3] ^= rng[1];
+  rng[1] ^= rng[2];
+  rng[0] ^= rng[3];
+  rng[2] ^= t;
+  rng[3] = (rng[3] << 45) | (rng[3] >> 19);
+  
+  return res;
+}
+
+/* uniform in [0, 1) */
+static double
+uniform()
+{
+  return (next() >> 11) * 0x1.0p-53;
+}
+
+static int
+draw_size()
+{
+  double u = uniform();
+  int a, b, size;
+  
+  switch (sizes)
+    {
+    case SLINEAR:
+      return (int) (lo + u * (hi - lo));
+    case SZIPF:
+      a = 0;
+      b = zipfsizes - 1;
+      while (a < b)
+	{ // first rank whose cumulative share reaches u
+	  int m = (a + b) / 2;
+  
+	  if (zipfcdf[m] < u)
+	    a = m + 1;
+	  else
+	    b = m;
+	}
+      return zipfsize[a];
+    case SBIMODAL:
+      // the bottom and top quarters of the range, log-uniform, held
+      // within it where the range is narrower than 16:1
+      if (u < share)
+	size = (int) (lo * pow(4.0, uniform()));
+      else
+	size = (int) (hi / 4 * pow(4.0, uniform()));
+      if (size < lo)
+	return (int) lo;
+      return size > hi ? (int) hi : size;
+    case SSPIKE:
+      if (u < share)
+	return spikesize;
+      u = uniform();
+      break;
+    }
+  
+  size = (int) (lo * pow(hi / lo, u));
+  return size < minsize ? minsize : size;
+}
+
+/*  Picks the step a request made at step i dies at, given the length
+ *  of the trace and the end of the phase: requests do not outlive their
+ *  phase, so a phase change frees its whole working set.
+ */
+static unsigned long long
+draw_death(unsigned long long i, unsigned long long count,
+	   unsigned long long end)
+{
+  unsigned long long rest = count - i, death;
+  
+  switch (lifetimes)
+    {
+    case LEARLY:
+      if (uniform() < 0.9)
+	{
+	  death = i + 1 + (unsigned long long) (uniform() * (rest / 10 + 1));
+	  break;
+	}
+      // fall through
+    case LUNIFORM:
+      death = i + 1 + (unsigned long long) (uniform() * rest);
+      break;
+    case LFIFO:
+      death = i + depth;
+      break;
+    case LEXP:
+    default:
+      death = i + 1 + (unsigned long long) (-mean * log(1 - uniform()));
+      break;
+    }
+  
+  if (death > end)
+    {
+      death = end;
+    }
+  return death < NEVER ? death : NEVER;
+}
+
+/*  Picks the thread making a request, given -1, or the one freeing a
+ *  request made by thread tid. A single thread draws nothing, so the
+ *  traces of a seed stay what they were before there were threads.
+ */
+static int
+draw_tid(int tid)
+{
+  if (threads == 1)
+    {
+      return 0;
+    }
+  if (producer)
+    {
+      return tid < 0 ? 0 : 1 + next() % (threads - 1);
+    }
+  if (tid < 0)
+    {
+      return next() % threads;
+    }
+  if (uniform() < cross)
+    {
+      return (tid + 1 + next() % (threads - 1)) % threads;
+    }
+  return tid;
+}
+
+/* sets up the sizes of phase k: every phase draws from its own band */
+static void
+phase(int k)
+{
+  double total = 0, span;
+  int r;
+  
+  lo = minsize;
+  hi = maxsize;
+  if (phases > 1)
+    { // a band a quarter of the log range wide, placed at random
+      span = log((double) maxsize / minsize);
+      lo = minsize * exp(uniform() * span * 0.75);
+      hi = lo * exp(span * 0.25);
+    }
+  
+  for (r = 0; r < zipfsizes; r++)
+    {
+      zipfsize[r] = (int) (lo * pow(hi / lo, uniform()));
+      total += 1 / pow(r + 1, zipfexp);
+      zipfcdf[r] = total;
+    }
+  for (r = 0; r < zipfsizes; r++)
+    {
+      zipfcdf[r] /= total;
+    }
+}
+
+static void
+push(live_t req)
+{
+  int i = nlive++;
+  
+  if (nlive > heapcap)
+    {
+      heapcap = heapcap ? 2 * heapcap : 1024;
+      heap = realloc(heap, heapcap * sizeof(live_t));
+      assert(heap != NULL);
+    }
+  
+  while (i > 0 && heap[(i - 1) / 4].key > req.key)
+    {
+      heap[i] = heap[(i - 1) / 4];
+      i = (i - 1) / 4;
+    }
+  heap[i] = req;
+  
+  bytes += req.size;
+  if (bytes > maxbytes)
+    {
+      maxbytes = bytes;
+    }
+}
+
+static live_t
+pop()
+{
+  live_t res = heap[0], last = heap[--nlive];
+  int i = 0, c, k, min;
+  
+  while ((c = 4 * i + 1) < nlive)
+    {
+      // smallest of up to four children
+      min = c;
+      for (k = c + 1; k < c + 4 && k < nlive; k++)
+	{
+	  if (heap[k].key < heap[min].key)
+	    {
+	      min = k;
+	    }
+	}
+      if (last.key < heap[min].key)
+	{
+	  break;
+	}
+      heap[i] = heap[min];
+      i = min;
+    }
+  heap[i] = last;
+  
+  bytes -= res.size;
+  return res;
+}
+
+/* appends one op to the output buffer */
+static void
+emit(unsigned int id, unsigned int size, int tid)
+{
+  char digits[12];
+  int n;
+  
+  if (olen > OUTBUF - 64)
+    {
+      flush();
+    }
+  
+  if (binary)
+    {
+      ktrace_op_t op = { id, size, tid };
+  
+      memcpy(obuf + olen, &op, sizeof(op));
+      olen += sizeof(op);
+      return;
+    }
+  
+  // printf would dominate the run time at 10^8 ops
+  if (tid != curtid)
+    {
+      olen += sprintf(obuf + olen, "THREAD %d\n", tid);
+      curtid = tid;
+    }
+  if (size == OPFREE)
+    {
+      memcpy(obuf + olen, "FREE ", 5);
+      olen += 5;
+    }
+  else
+    {
+      memcpy(obuf + olen, "REQUEST ", 8);
+      olen += 8;
+    }
+  
+  n = 0;
+  do
+    {
+      digits[n++] = '0' + id % 10;
+      id /= 10;
+    }
+  while (id > 0);
+  while (n > 0)
+    {
+      obuf[olen++] = digits[--n];
+    }
+  
+  if (size != OPFREE)
+    {
+      obuf[olen++] = ' ';
+      n = 0;
+      do
+	{
+	  digits[n++] = '0' + size % 10;
+	  size /= 10;
+	}
+      while (size > 0);
+      while (n > 0)
+	{
+	  obuf[olen++] = digits[--n];
+	}
+    }
+  obuf[olen++] = '\n';
+}
+
+static void
+flush()
+{
+  if (olen > 0 && fwrite(obuf, 1, olen, out) != (size_t) olen)
+    {
+      error("unable to write output file", "");
+    }
+  olen = 0;
+}
+
+static void
+usage(char* name)
+{
+  printf("Usage: %s [options] allocation_count "
+	 "{log|linear|zipf|bimodal|spike}\n"
+	 "       min_request_size max_request_size {uniform|early|fifo|exp} "
+	 "out_file\n"
+	 "  -r seed     random seed (default 1); equal seeds, equal traces\n"
+	 "  -b          write the binary format instead of text\n"
+	 "  -z n        zipf: number of distinct sizes (default 64)\n"
+	 "  -e s        zipf: popularity exponent (default 1.0)\n"
+	 "  -f share    bimodal: share of small requests (default 0.8);\n"
+	 "              spike: share of the spike size (default 0.5)\n"
+	 "  -k size     spike: the spike size (default sqrt(min * max))\n"
+	 "  -q depth    fifo: requests between an allocation and its free\n"
+	 "              (default 1000)\n"
+	 "  -m mean     exp: mean lifetime in requests (default 1000)\n"
+	 "  -p phases   split the trace into phases, each with its own size\n"
+	 "              band and freeing its working set at the end\n"
+	 "  -l share    share of long-lived requests, freed at the very end\n"
+	 "  -t threads  spread the requests over this many thread streams\n"
+	 "              (default 1)\n"
+	 "  -x share    share of the requests freed by another thread than\n"
+	 "              the one that made them (default 0.25)\n"
+	 "  -o          one producer: thread 0 makes every request and the\n"
+	 "              other threads free them\n",
+	 name);
+  exit(1);
+}
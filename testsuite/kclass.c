@@ -0,0 +1,89 @@
+/***************************************************************************
+ *  Title: Size Classes
+ * -------------------------------------------------------------------------
+ *    Purpose: Precomputed size-class tables shared by the kernel memory
+ *             allocators
+ *    File: $RCSfile: kclass.c,v $
+ ***************************************************************************/
+#define __KCLASS_IMPL__
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+#include "kclass.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/************Global Variables*********************************************/
+
+//  size, objs, waste
+const kclass_t gclass[NUMCLASSES] =
+  {
+    {   16, 512,    0 },
+    {   32, 256,    0 },
+    {   64, 128,    0 },
+    {  128,  64,    0 },
+    {  256,  32,    0 },
+    {  512,  16,    0 },
+    { 1024,   8,    0 },
+    { 2048,   4,    0 },
+    { 4096,   2,    0 },
+    { 8192,   1,    0 },
+  };
+
+const kclass_t gfineclass[NUMFINECLASSES] =
+  {
+    {   16, 512,    0 },
+    {   32, 256,    0 },
+    {   48, 170,   32 },
+    {   64, 128,    0 },
+    {   80, 102,   32 },
+    {   96,  85,   32 },
+    {  112,  73,   16 },
+    {  128,  64,    0 },
+    {  160,  51,   32 },
+    {  192,  42,  128 },
+    {  224,  36,  128 },
+    {  256,  32,    0 },
+    {  320,  25,  192 },
+    {  384,  21,  128 },
+    {  448,  18,  128 },
+    {  512,  16,    0 },
+    {  640,  12,  512 },
+    {  768,  10,  512 },
+    {  896,   9,  128 },
+    { 1024,   8,    0 },
+    { 1280,   6,  512 },
+    { 1536,   5,  512 },
+    { 1792,   4, 1024 },
+    { 2048,   4,    0 },
+    { 2560,   3,  512 },
+    { 3072,   2, 2048 },
+    { 3584,   2, 1024 },
+    { 4096,   2,    0 },
+    { 5120,   1, 3072 },
+    { 6144,   1, 2048 },
+    { 7168,   1, 1024 },
+    { 8192,   1,    0 },
+  };
+
+// fine class of each 16-byte granule up to FINEMAPMAX
+const unsigned char gfinemap[FINEMAPMAX / MINCLASSSIZE + 1] =
+  {
+     0,  0,  1,  2,  3,  4,  5,  6,  7,  8,  8,  9,  9,
+    10, 10, 11, 11, 12, 12, 12, 12, 13, 13, 13, 13, 14,
+    14, 14, 14, 15, 15, 15, 15, 16, 16, 16, 16, 16, 16,
+    16, 16, 17, 17, 17, 17, 17, 17, 17, 17, 18, 18, 18,
+    18, 18, 18, 18, 18, 19, 19, 19, 19, 19, 19, 19, 19
+  };
+
+/************Function Prototypes******************************************/
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
@@ -0,0 +1,103 @@
+/***************************************************************************
+ *  Title: Allocator Layers
+ * -------------------------------------------------------------------------
+ *    Purpose: The plumbing shared by the caches that stack on top of
+ *             another registered kernel memory allocator
+ *    File: $RCSfile: klayer.c,v $
+ ***************************************************************************/
+#define __KLAYER_IMPL__
+
+/************System include***********************************************/
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/************Private include**********************************************/
+#include "kma.h"
+#include "klayer.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+kma_ops_t*
+layer_wrap(kma_ops_t* base, char* suffix, const kma_ops_t* ops, int option)
+{
+  klayer_t* layer;
+  char* name;
+  
+  if (base->init == ops->init)
+    {
+      return NULL;
+    }
+  
+  layer = malloc(sizeof(klayer_t));
+  name = malloc(strlen(base->name) + strlen(suffix) + 1);
+  assert(layer != NULL && name != NULL);
+  sprintf(name, "%s%s", base->name, suffix);
+  
+  layer->ops = *ops;
+  layer->ops.name = name;
+  layer->base = base;
+  layer->option = option;
+  kma_register(&layer->ops);
+  
+  return &layer->ops;
+}
+
+klayer_t*
+layer_init(klayer_base_t* b)
+{
+  klayer_t* self = (klayer_t*) gkma;
+  
+  b->ops = self->base;
+  b->locked = !(b->ops->flags & KMA_THREADSAFE);
+  
+  if (b->ops->init != NULL)
+    {
+      gkma = b->ops;
+      b->ops->init();
+      gkma = &self->ops;
+    }
+  
+  return self;
+}
+
+void
+layer_stats(klayer_base_t* b)
+{
+  if (b->ops->stats != NULL)
+    {
+      b->ops->stats();
+    }
+}
+
+void
+layer_flush(klayer_base_t* b)
+{
+  if (b->ops->flush != NULL)
+    {
+      b->ops->flush();
+    }
+}
+
+void
+layer_teardown(klayer_base_t* b)
+{
+  if (b->ops->teardown != NULL)
+    {
+      b->ops->teardown();
+    }
+}
@@ -0,0 +1,83 @@
+/***************************************************************************
+ *  Title: Intrusive Lists
+ * -------------------------------------------------------------------------
+ *    Purpose: Circular doubly-linked lists threaded through the free
+ *             blocks themselves, so any block can be unlinked in
+ *             constant time without searching for its predecessor
+ *    File: $RCSfile: klist.h,v $
+ ***************************************************************************/
+
+#ifndef __KLIST_H__
+#define __KLIST_H__
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/*  A list is a sentinel node; an empty list points to itself. The
+ *  node lives in the first bytes of a free block, so blocks must be
+ *  at least sizeof(klist_t) long.
+ */
+typedef struct klist
+{
+  struct klist* next;
+  struct klist* prev;
+} klist_t;
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+static inline void
+klist_init(klist_t* head)
+{
+  head->next = head;
+  head->prev = head;
+}
+
+static inline int
+klist_empty(klist_t* head)
+{
+  return head->next == head;
+}
+
+/* inserts node at the front of the list */
+static inline void
+klist_add(klist_t* head, klist_t* node)
+{
+  node->next = head->next;
+  node->prev = head;
+  head->next->prev = node;
+  head->next = node;
+}
+
+/* unlinks node from whatever list it is on */
+static inline void
+klist_del(klist_t* node)
+{
+  node->prev->next = node->next;
+  node->next->prev = node->prev;
+}
+
+/* unlinks and returns the first node, the list must not be empty */
+static inline klist_t*
+klist_pop(klist_t* head)
+{
+  klist_t* node = head->next;
+  
+  klist_del(node);
+  return node;
+}
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __KLIST_H__ */
@@ -54,10 +54,18 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
 
 /************Private include**********************************************/
 #include "kpage.h"
 #include "kma.h"
+#include "kmag.h"
+#include "kpcpu.h"
+#include "ktrace.h"
+#include "khist.h"
 
 /************Defines and Typedefs*****************************************/
 /*  #defines and typedefs should have their names in all caps.
@@ -66,29 +74,134 @@
  *  structures and arrays, line everything up in neat columns.
  */
 
+/*  largest request the allocators must serve: a whole get_pages() block
+ *  less a pointer for allocators that keep a header in front
+ */
+#define MAXREQUEST ((PAGESIZE << (MAXORDER - 1)) - sizeof(void*))
+
 enum REQ_STATE
   {
     FREE,
     USED
   };
 
+/*  The per-algorithm builds (-DKMA_BUD and so on) default to their
+ *  algorithm; a plain build runs every registered one.
+ */
+#if defined(KMA_DUMMY)
+#define DEFAULTKMA "dummy"
+#elif defined(KMA_RM)
+#define DEFAULTKMA "rm"
+#elif defined(KMA_P2FL)
+#define DEFAULTKMA "p2fl"
+#elif defined(KMA_MCK2)
+#define DEFAULTKMA "mck2"
+#elif defined(KMA_BUD)
+#define DEFAULTKMA "bud"
+#elif defined(KMA_LZBUD)
+#define DEFAULTKMA "lzbud"
+#else
+#define DEFAULTKMA "all"
+#endif
+
+/*  kma_malloc() and kma_free() latencies are kept per op and per size
+ *  bin, bin b holding the sizes in (2^(b-1), 2^b]
+ */
+enum LAT_OP
+  {
+    LATMALLOC,
+    LATFREE,
+    NUMLATOPS
+  };
+
+/*  Correctness mode keeps no copy of the blocks: word k of request id
+ *  must hold PATTERN(pattern_seed(id), k), and a trailing partial word
+ *  the low bytes of the next one.
+ */
+#define PATTERN(seed, k) ((seed) ^ ((unsigned long long) (k) * 0x9e3779b97f4a7c15ULL))
+
+/*  kma_output.dat gets a sample of bytes requested and page bytes in
+ *  use every ginterval ops. Samples are buffered as numbers and only
+ *  formatted when the buffer fills.
+ */
+#define NUMSAMPLES 65536
+
+typedef struct
+{
+  unsigned long long op;
+  long long alloc;
+  long long pages;
+} sample_t;
+
+#define NUMSIZEBINS 32
+#define SIZEBIN(size) ((size) <= 1 ? 0 : 32 - __builtin_clz((size) - 1))
+
+/*  With -j the streams of the trace run on real threads, thread t
+ *  taking the streams numbered t modulo the thread count, in trace
+ *  order. A block freed on another thread than the one allocating it
+ *  is handed over through its shared_t: the free waits until the
+ *  allocation has been published, which it always is eventually since
+ *  it comes first in the trace. Each thread times only its calls into
+ *  the allocator, as the plain replay does, so neither thread start-up
+ *  nor filling, checking and waiting for blocks counts; the replay
+ *  takes as long as the busiest thread.
+ */
+#define MAXTHREADS 64
+#define REFUSED ((void*) -1)
+
+typedef struct
+{
+  void* ptr;                   // NULL until allocated, REFUSED if refused
+  int size;
+} shared_t;
+
+typedef struct
+{
+  ktrace_op_t* ops;
+  unsigned long long n_ops;
+  unsigned long long ticks;    // spent in kma_malloc() and kma_free()
+  pthread_barrier_t* start;
+} worker_t;
+
 typedef struct mem
 {
   int size;
   void* ptr;
-  void* value; // to check correctness
   enum REQ_STATE state;
 } mem_t;
 
 /************Global Variables*********************************************/
 
-static int val = 0;
+
+static khist_t glat[NUMLATOPS][NUMSIZEBINS];
+static char* klatname[NUMLATOPS] = { "kma_malloc", "kma_free" };
+
+/* print the latencies per size bin, not just per op */
+static bool detail = FALSE;
+
+static sample_t gsamples[NUMSAMPLES];
+static int nsamples = 0;
+static int ginterval = 1;
+
+/* most threads the -j replay scales to, 0 for the plain replay */
+static int gthreads = 0;
+static shared_t* gshared = NULL;
 
 /************Function Prototypes******************************************/
+void replay(kma_ops_t*, ktrace_t*, bool);
+void scaling(kma_ops_t*, ktrace_t*, int);
+double replay_mt(ktrace_t*, int);
+void* stream(void*);
+void check_streams(ktrace_t*);
+void sample(FILE*, unsigned long long);
+void samples_flush(FILE*);
+void latency();
+void latency_line(char*, khist_t*);
 void allocate();
 void deallocate();
-void fill(char*, int);
-void check(char*, char*, int);
+unsigned long long pattern_seed(int);
+void fill(char*, int, int);
+void check(char*, int, int);
 void usage();
 void error(char*, char*);
 void pass();
@@ -109,118 +222,224 @@ char *name = NULL;
 int
 main(int argc, char* argv[])
 {
+  kma_ops_t* selected[MAXALLOCATORS];
+  char* list = DEFAULTKMA;
+  char* alg;
+  ktrace_t trace;
+  int n_sel = 0, i, c;
   
   name = argv[0];
   
+  while ((c = getopt(argc, argv, "a:j:ls:")) != -1)
+    {
+      switch (c)
+	{
+	case 'a':
+	  list = optarg;
+	  break;
+	case 'j':
+	  gthreads = atoi(optarg);
+	  if (gthreads < 1 || gthreads > MAXTHREADS)
+	    {
+	      usage();
+	    }
+	  break;
+	case 'l':
+	  detail = TRUE;
+	  break;
+	case 's':
+	  ginterval = atoi(optarg);
+	  if (ginterval < 1)
+	    {
+	      usage();
+	    }
+	  break;
+	default:
+	  usage();
+	}
+    }
+  
+  if (optind != argc - 1)
+    {
+      usage();
+    }
+  
 #ifdef COMPETITION
   printf("%s: Running in competition mode\n", name);
 #endif
-
+  
 #ifndef COMPETITION
   printf("%s: Running in correctness mode\n", name);
 #endif
+  
+  if (strcmp(list, "all") == 0)
+    {
+      for (i = 0; i < kma_count(); i++)
+	{
+	  selected[n_sel++] = kma_get(i);
+	}
+    }
+  else
+    {
+      for (alg = strtok(list, ","); alg != NULL; alg = strtok(NULL, ","))
+	{
+	  if (n_sel == MAXALLOCATORS)
+	    {
+	      error("too many allocators", alg);
+	    }
+	  selected[n_sel] = kma_find(alg);
+	  if (selected[n_sel] == NULL)
+	    {
+	      error("unknown allocator", alg);
+	    }
+	  n_sel++;
+	}
+    }
+  
+  hist_calibrate();
+  
+  // map or decode the whole trace up front, so every allocator replays
+  // the same records and none of them pays for the parsing
+  trace_open(argv[optind], &trace);
+  
+  if (gthreads > 0)
+    {
+      check_streams(&trace);
+      if (gthreads > trace.hdr.n_threads)
+	{ // more threads would only idle
+	  printf("The trace has %u streams, scaling to %u threads\n",
+		 trace.hdr.n_threads, trace.hdr.n_threads);
+	  gthreads = trace.hdr.n_threads;
+	}
+      gshared = malloc(trace.hdr.n_req * sizeof(shared_t));
+      assert(gshared != NULL);
+    }
+  
+  for (i = 0; i < n_sel; i++)
+    {
+      if (gthreads > 0)
+	{
+	  scaling(selected[i], &trace, gthreads);
+	}
+      else
+	{
+	  replay(selected[i], &trace, n_sel > 1);
+	}
+    }
+  
+  free(gshared);
+  
+  trace_close(&trace);
+  
+  pass();
+  return 0;
+}
 
-  int n_req = 0, n_alloc=0, n_dealloc=0;
+void
+replay(kma_ops_t* alg, ktrace_t* trace, bool multiple)
+{
+  ktrace_op_t* op = trace->ops;
+  unsigned long long n_ops = trace->hdr.n_ops, i;
+  unsigned int n_req = trace->hdr.n_req;
+  long long n_alloc = 0, n_dealloc = 0;
   kpage_stat_t* stat;
-
+  struct timespec start, end;
+  
 #ifdef COMPETITION
   double ratioSum = 0.0;
   int ratioCount = 0;
 #endif
   
 #ifndef COMPETITION
-  FILE* allocTrace = fopen("kma_output.dat", "w");
-  if (allocTrace == NULL)
-    {
-      error("unable to open allocation output file", "kma_output.dat");
-    }
-  fprintf(allocTrace, "0 0 0\n");
-#endif
-
-  if (argc != 2)
+  char out[64] = "kma_output.dat";
+  int countdown = ginterval;
+  
+  if (multiple)
     {
-      usage();
+      snprintf(out, sizeof(out), "kma_output.%s.dat", alg->name);
     }
   
-  FILE* f_test = fopen(argv[1], "r");
-  if (f_test == NULL)
+  FILE* allocTrace = fopen(out, "w");
+  if (allocTrace == NULL)
     {
-      error("unable to open input test file", argv[1]);
+      error("unable to open allocation output file", out);
     }
+  fprintf(allocTrace, "0 0 0\n");
+#endif
   
-  // Get the number of requests in the trace file
-  // Allocate some memory...
-  int status = fscanf(f_test, "%d\n", &n_req);
-  if(status != 1)
-    error("Couldn't read number of requests at head of file", "");
+  printf("Allocator: %s\n", alg->name);
   
   mem_t* requests = malloc((n_req + 1)*sizeof(mem_t));
   memset(requests, 0, (n_req + 1)*sizeof(mem_t));
+  currentAllocBytes = 0;
+  memset(glat, 0, sizeof(glat));
   
-  char command[16];
-  int req_id, req_size, index = 1;
-
-  // Parse the lines in the file, and call allocate or
-  // deallocate accordingly.
-  while (fscanf(f_test, "%10s", command) == 1)
+  kma_use(alg);
+  
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  
+  for (i = 0; i < n_ops; i++, op++)
     {
-      if (strcmp(command, "REQUEST") == 0)
+      assert(op->id < n_req);
+      
+      if (op->size != OPFREE)
 	{
-	  
-	  if (fscanf(f_test, "%d %d", &req_id, &req_size) != 2)
-	    error("Not enough arguments to REQUEST", "");
-
-	  assert(req_id >= 0 && req_id < n_req);
-	  
-	  allocate(requests, req_id, req_size);
+	  allocate(requests, op->id, op->size);
 	  n_alloc++;
 	}
-      else if (strcmp(command, "FREE") == 0)
-	{
-	  if (fscanf(f_test, "%d", &req_id) != 1)
-	    error("Not enough arguments to FREE", "");
-	  
-	  assert(req_id >= 0 && req_id < n_req);
-	  
-	  deallocate(requests, req_id);
-	  n_dealloc++;
-	}
       else
 	{
-	  error("unknown command type:", command);
+	  deallocate(requests, op->id);
+	  n_dealloc++;
 	}
-
-      stat = page_stats();
-      int totalBytes = stat->num_in_use * stat->page_size;
-
-      
+  
 #ifdef COMPETITION
-      if(req_id < n_req && n_alloc != n_dealloc)
+      if(n_alloc != n_dealloc)
 	{
 	  // We can calculate the ratio of wasted to used memory here.
-
-	  int wastedBytes = totalBytes - currentAllocBytes;
+  
+	  long long wastedBytes = page_bytes_in_use() - currentAllocBytes;
 	  ratioSum += ((double) wastedBytes) / currentAllocBytes;
 	  ratioCount += 1;
 	}
 #endif
-
+  
 #ifndef COMPETITION
-      fprintf(allocTrace, "%d %d %d\n", index, currentAllocBytes, totalBytes);
+      if (--countdown == 0)
+	{
+	  countdown = ginterval;
+	  sample(allocTrace, i + 1);
+	}
 #endif
-      
-      index += 1;
     }
-
+  
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  
 #ifndef COMPETITION
+  if (countdown != ginterval)
+    { // the plot always ends with the last op
+      sample(allocTrace, n_ops);
+    }
+  samples_flush(allocTrace);
   fclose(allocTrace);
 #endif
   
+  free(requests);
   
+  if (alg->flush != NULL)
+    { // blocks cached by this thread still hold their pages
+      alg->flush();
+    }
   stat = page_stats();
   
   printf("Page Requested/Freed/In Use: %5d/%5d/%5d\n",
 	 stat->num_requested, stat->num_freed, stat->num_in_use);	
+  printf("Peak pages in use: %d\n", stat->num_peak);
+  
+  if (alg->stats != NULL)
+    {
+      alg->stats();
+    }
   
   if (stat->num_requested != stat->num_freed || stat->num_in_use != 0)
     {
@@ -231,13 +450,303 @@ main(int argc, char* argv[])
     {
       error("there were memory mismatches", "");
     }
-
+  
+  printf("Replay time: %.6f s\n", (end.tv_sec - start.tv_sec)
+	 + (end.tv_nsec - start.tv_nsec) * 1e-9);
+  latency();
+  
 #ifdef COMPETITION
   printf("Competition average ratio: %f\n", ratioSum / ratioCount);
 #endif
   
-  pass();
-  return 0;
+  kma_done();
+}
+
+/* replays the trace on 1 to max_threads threads and reports the speedup */
+void
+scaling(kma_ops_t* alg, ktrace_t* trace, int max_threads)
+{
+  kpage_stat_t* stat;
+  double seconds, base = 0;
+  int k;
+  
+  printf("Allocator: %s\n", alg->name);
+  if (!(alg->flags & KMA_THREADSAFE))
+    {
+      printf("Not thread-safe, skipped\n");
+      return;
+    }
+  
+  printf("%8s %12s %14s %8s\n", "Threads", "Time (s)", "Ops/s", "Speedup");
+  for (k = 1; k <= max_threads; k++)
+    {
+      kma_use(alg);
+      seconds = replay_mt(trace, k);
+      
+      if (alg->flush != NULL)
+	{ // the workers have exited, so what is cached now is shared
+	  alg->flush();
+	}
+      stat = page_stats();
+      if (stat->num_requested != stat->num_freed || stat->num_in_use != 0)
+	{
+	  error("not all pages freed", "");
+	}
+      if (anyMismatches)
+	{
+	  error("there were memory mismatches", "");
+	}
+      
+      if (k == 1)
+	{
+	  base = seconds;
+	}
+      printf("%8d %12.6f %14.0f %7.2fx\n", k, seconds,
+	     trace->hdr.n_ops / seconds, base / seconds);
+      if (k == max_threads && alg->stats != NULL)
+	{
+	  alg->stats();
+	}
+      kma_done();
+    }
+}
+
+/* runs the streams on n_threads threads, returns the time the busiest
+ * of them spent in the allocator */
+double
+replay_mt(ktrace_t* trace, int n_threads)
+{
+  worker_t workers[MAXTHREADS];
+  pthread_t threads[MAXTHREADS];
+  pthread_barrier_t start;
+  unsigned long long ticks = 0;
+  ktrace_op_t* op;
+  worker_t* w;
+  unsigned long long i;
+  int t;
+  
+  // split the trace before the threads start
+  memset(workers, 0, sizeof(workers));
+  for (i = 0, op = trace->ops; i < trace->hdr.n_ops; i++, op++)
+    {
+      workers[op->tid % n_threads].n_ops++;
+    }
+  for (t = 0; t < n_threads; t++)
+    {
+      workers[t].ops = malloc(workers[t].n_ops * sizeof(ktrace_op_t));
+      assert(workers[t].ops != NULL || workers[t].n_ops == 0);
+      workers[t].n_ops = 0;
+      workers[t].start = &start;
+    }
+  for (i = 0, op = trace->ops; i < trace->hdr.n_ops; i++, op++)
+    {
+      w = &workers[op->tid % n_threads];
+      w->ops[w->n_ops++] = *op;
+    }
+  memset(gshared, 0, trace->hdr.n_req * sizeof(shared_t));
+  
+  pthread_barrier_init(&start, NULL, n_threads + 1);
+  for (t = 0; t < n_threads; t++)
+    {
+      if (pthread_create(&threads[t], NULL, stream, &workers[t]) != 0)
+	{
+	  error("unable to create replay thread", "");
+	}
+    }
+  
+  pthread_barrier_wait(&start);
+  for (t = 0; t < n_threads; t++)
+    {
+      pthread_join(threads[t], NULL);
+    }
+  
+  pthread_barrier_destroy(&start);
+  for (t = 0; t < n_threads; t++)
+    {
+      if (workers[t].ticks > ticks)
+	{
+	  ticks = workers[t].ticks;
+	}
+      free(workers[t].ops);
+    }
+  
+  return ticks * ghistns * 1e-9;
+}
+
+/* replays the ops of one thread */
+void*
+stream(void* arg)
+{
+  worker_t* w = arg;
+  ktrace_op_t* op = w->ops;
+  ktrace_op_t* end = w->ops + w->n_ops;
+  shared_t* req;
+  unsigned long long t;
+  void* ptr;
+  
+  pthread_barrier_wait(w->start);
+  
+  for (; op < end; op++)
+    {
+      req = &gshared[op->id];
+      if (op->size != OPFREE)
+	{
+	  t = hist_now();
+	  ptr = kma_malloc(op->size);
+	  w->ticks += hist_now() - t;
+	  if ((ptr == NULL) != (op->size > MAXREQUEST))
+	    {
+	      error("got NULL from kma_malloc for alloc'able request", "");
+	    }
+#ifndef COMPETITION
+	  if (ptr != NULL)
+	    {
+	      fill((char*)ptr, op->id, op->size);
+	    }
+#endif
+	  req->size = op->size;
+	  __atomic_store_n(&req->ptr, ptr != NULL ? ptr : REFUSED,
+			   __ATOMIC_RELEASE);
+	}
+      else
+	{
+	  // the thread allocating it may not have got there yet
+	  while ((ptr = __atomic_load_n(&req->ptr, __ATOMIC_ACQUIRE)) == NULL)
+	    {
+	      sched_yield();
+	    }
+	  if (ptr != REFUSED)
+	    {
+#ifndef COMPETITION
+	      check((char*)ptr, op->id, req->size);
+#endif
+	      t = hist_now();
+	      kma_free(ptr, req->size);
+	      w->ticks += hist_now() - t;
+	    }
+	}
+    }
+  
+  return NULL;
+}
+
+/*  A free waits for its request forever, so the threaded replay needs
+ *  every id requested once and freed once after that.
+ */
+void
+check_streams(ktrace_t* trace)
+{
+  char* state = calloc(trace->hdr.n_req, 1);
+  ktrace_op_t* op = trace->ops;
+  unsigned long long i;
+  
+  assert(state != NULL);
+  for (i = 0; i < trace->hdr.n_ops; i++, op++)
+    {
+      // 0 before the request, 1 while live, 2 once freed
+      if (op->id >= trace->hdr.n_req
+	  || state[op->id] != (op->size != OPFREE ? 0 : 1))
+	{
+	  error("threaded replay needs every id requested and freed once", "");
+	}
+      state[op->id]++;
+    }
+  free(state);
+}
+
+/* buffers one point of the allocation-vs-pages series */
+void
+sample(FILE* f, unsigned long long op)
+{
+  gsamples[nsamples].op = op;
+  gsamples[nsamples].alloc = currentAllocBytes;
+  gsamples[nsamples].pages = page_bytes_in_use();
+  if (++nsamples == NUMSAMPLES)
+    {
+      samples_flush(f);
+    }
+}
+
+/* formats the buffered samples; printf would cost more than the replay */
+void
+samples_flush(FILE* f)
+{
+  static char buf[NUMSAMPLES * 64];
+  unsigned long long v[3];
+  char digits[24];
+  char* p = buf;
+  int i, k, n;
+  
+  for (i = 0; i < nsamples; i++)
+    {
+      v[0] = gsamples[i].op;
+      v[1] = gsamples[i].alloc;
+      v[2] = gsamples[i].pages;
+      for (k = 0; k < 3; k++)
+	{
+	  n = 0;
+	  do
+	    {
+	      digits[n++] = '0' + v[k] % 10;
+	      v[k] /= 10;
+	    }
+	  while (v[k] > 0);
+	  while (n > 0)
+	    {
+	      *p++ = digits[--n];
+	    }
+	  *p++ = k < 2 ? ' ' : '\n';
+	}
+    }
+  
+  fwrite(buf, 1, p - buf, f);
+  nsamples = 0;
+}
+
+/* reports the allocator-only time and the latency quantiles */
+void
+latency()
+{
+  khist_t total[NUMLATOPS];
+  double seconds = 0;
+  char label[32];
+  int op, bin;
+  
+  printf("%-16s %10s %8s %8s %8s %10s\n", "Latency (ns)", "count",
+	 "p50", "p99", "p99.9", "max");
+  
+  for (op = 0; op < NUMLATOPS; op++)
+    {
+      memset(&total[op], 0, sizeof(khist_t));
+      for (bin = 0; bin < NUMSIZEBINS; bin++)
+	{
+	  hist_merge(&total[op], &glat[op][bin]);
+	}
+      latency_line(klatname[op], &total[op]);
+      
+      for (bin = 0; detail && bin < NUMSIZEBINS; bin++)
+	{
+	  if (glat[op][bin].count > 0)
+	    {
+	      snprintf(label, sizeof(label), "  <= %u B", 1U << bin);
+	      latency_line(label, &glat[op][bin]);
+	    }
+	}
+      
+      seconds += total[op].sum * ghistns * 1e-9;
+    }
+  
+  printf("Allocator time: %.6f s (kma_malloc %.6f s, kma_free %.6f s)\n",
+	 seconds, total[LATMALLOC].sum * ghistns * 1e-9,
+	 total[LATFREE].sum * ghistns * 1e-9);
+}
+
+void
+latency_line(char* label, khist_t* h)
+{
+  printf("%-16s %10llu %8.0f %8.0f %8.0f %10.0f\n", label, h->count,
+	 hist_quantile(h, 0.5) * ghistns, hist_quantile(h, 0.99) * ghistns,
+	 hist_quantile(h, 0.999) * ghistns, h->max * ghistns);
 }
 
 void
@@ -256,7 +765,23 @@ pass()
 
 void
 usage() {
-  printf("Usage: %s traceFile\n", name);
+  int i;
+
+  printf("Usage: %s [-a allocator[,allocator...]|all] [-j n] [-l] [-s n] traceFile\n", name);
+  printf("  -j  replay the trace streams on 1 to n threads, thread-safe\n"
+	 "      allocators only\n");
+  printf("  -l  latencies per size bin as well as per op\n");
+  printf("  -s  write every n-th op to kma_output.dat (default 1)\n");
+  printf("The trace is text or binary (see trace2bin).\n");
+  printf("Allocators:");
+  for (i = 0; i < kma_count(); i++)
+    {
+      printf(" %s", kma_get(i)->name);
+    }
+  printf("\n");
+  printf("Any of them followed by %s runs behind per-CPU magazines, by\n"
+	 "%s behind rseq per-CPU caches, by %s behind per-thread ones.\n",
+	 MAGSUFFIX, PCPUSUFFIX, TCACHESUFFIX);
   exit(0);
 }
 
@@ -270,15 +795,19 @@ void
 allocate(mem_t* requests, int req_id, int req_size)
 {
   mem_t* new = &requests[req_id];
+  unsigned long long t;
   
   assert(new->state == FREE);
   
   new->size = req_size;
+  
+  t = hist_now();
   new->ptr = kma_malloc(new->size);
+  hist_record(&glat[LATMALLOC][SIZEBIN(req_size)], hist_now() - t);
   
   // Accept a NULL response in some cases... 
-  if(!(((new->ptr != NULL) && (new->size <= (PAGESIZE - sizeof(void*))))
-       || ((new->ptr == NULL) && (new->size > (PAGESIZE - sizeof(void*))))))
+  if(!(((new->ptr != NULL) && (new->size <= MAXREQUEST))
+       || ((new->ptr == NULL) && (new->size > MAXREQUEST))))
     {
       error("got NULL from kma_malloc for alloc'able request", "");
     }
@@ -287,26 +816,18 @@ allocate(mem_t* requests, int req_id, int req_size)
     {
       return;
     }
-
+  
   currentAllocBytes += req_size;
   
 #ifndef COMPETITION
-  // Only run the actual memory accesses/copies/checks if we're
-  // testing for correctness.
-  
-  new->value = malloc(new->size);
-  assert(new->value != NULL);
-  
-  // initialize memory
-  fill((char*)new->ptr, new->size);
-  
-  // copy the value for further reference
-  bcopy(new->ptr, new->value, new->size);
-  
-  check((char*)new->ptr, (char*)new->value, new->size);
+  // Only run the actual memory accesses/checks if we're testing for
+  // correctness.
   
+  // initialize memory; what it must hold is derived from the id, so
+  // a block overwritten by another shows up when it is freed
+  fill((char*)new->ptr, req_id, new->size);
 #endif
-
+  
   new->state = USED;
 }
 
@@ -314,50 +835,88 @@ void
 deallocate(mem_t* requests, int req_id)
 {
   mem_t* cur = &requests[req_id];
+  unsigned long long t;
   
   assert(cur->state == USED);
   assert(cur->size > 0);
   
 #ifndef COMPETITION
   // Only run the memory checks if we're testing for correctness.
-
+  
   // check memory
-  check((char*)cur->ptr, (char*)cur->value, cur->size);
-
-  // free memory
-  free(cur->value);
+  check((char*)cur->ptr, req_id, cur->size);
 #endif
-
+  
+  t = hist_now();
   kma_free(cur->ptr, cur->size);
-
+  hist_record(&glat[LATFREE][SIZEBIN(cur->size)], hist_now() - t);
+  
   currentAllocBytes -= cur->size;
   
   cur->state = FREE;
 }
 
+/* spreads the request id over a whole word (splitmix64) */
+unsigned long long
+pattern_seed(int id)
+{
+  unsigned long long z = (unsigned long long) id + 0x9e3779b97f4a7c15ULL;
+  
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
 void
-fill(char* ptr, int size)
+fill(char* ptr, int id, int size)
 {
-  int i;
+  unsigned long long seed = pattern_seed(id), w;
+  int k, n = size / 8;
   
-  for (i = 0; i < size; i++)
+  // word at a time; memcpy keeps it legal for any alignment and the
+  // compiler turns the loop into vector stores
+  for (k = 0; k < n; k++)
     {
-      ptr[i] = (char) val++;
+      w = PATTERN(seed, k);
+      memcpy(ptr + 8 * k, &w, 8);
     }
+  w = PATTERN(seed, n);
+  memcpy(ptr + 8 * n, &w, size % 8);
 }
 
 void
-check(char* lhs, char* rhs, int size)
+check(char* ptr, int id, int size)
 {
-  int i;
+  unsigned long long seed = pattern_seed(id), w, diff = 0;
+  int k, n = size / 8, i;
+  
+  // fold the differences first, the common case has none
+  for (k = 0; k < n; k++)
+    {
+      memcpy(&w, ptr + 8 * k, 8);
+      diff |= w ^ PATTERN(seed, k);
+    }
+  w = PATTERN(seed, n);
+  if (diff == 0 && memcmp(ptr + 8 * n, &w, size % 8) == 0)
+    {
+      return;
+    }
   
-  for (i = 0; i < size; i++)
+  // report the first bad byte and how many there are
+  for (i = 0, n = 0, k = -1; i < size; i++)
     {
-      if (lhs[i] != rhs[i])
+      w = PATTERN(seed, i / 8);
+      if (ptr[i] != ((char*)&w)[i % 8])
 	{
-	  fprintf(stderr, "memory mismatch at position %d (%3d!=%3d)\n", 
-		  i, lhs[i], rhs[i]);
-	  anyMismatches = 1;
+	  n++;
+	  if (k < 0)
+	    {
+	      k = i;
+	      fprintf(stderr, "memory mismatch in request %d at position %d "
+		      "(%3d!=%3d)\n", id, i, ptr[i], ((char*)&w)[i % 8]);
+	    }
 	}
     }
+  fprintf(stderr, "request %d: %d of %d bytes mismatched\n", id, n, size);
+  anyMismatches = 1;
 }
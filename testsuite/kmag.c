@@ -0,0 +1,471 @@
+/***************************************************************************
+ *  Title: Magazine Layer
+ * -------------------------------------------------------------------------
+ *    Purpose: Bonwick's per-CPU magazines and depot, stacked on top of
+ *             any registered kernel memory allocator. Every CPU holds a
+ *             loaded and a previous magazine per size class and serves
+ *             its callers from them; a depot per class trades full
+ *             magazines for empty ones, and only when the depot has
+ *             neither is the allocator underneath called. Magazines
+ *             grow when the depot lock is found contended.
+ *    File: $RCSfile: kmag.c,v $
+ ***************************************************************************/
+#define __KMAG_IMPL__
+
+/************System include***********************************************/
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/************Private include**********************************************/
+#include "kpage.h"
+#include "kclass.h"
+#include "kma.h"
+#include "klayer.h"
+#include "kmag.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/*  Requests are rounded up to a power-of-two class so that a cached
+ *  block fits any request of its class; classes above MAGCLASSES, the
+ *  whole page, go straight to the allocator underneath.
+ */
+#define MAGCLASSES (NUMCLASSES - 1)
+#define MAGMAXSIZE (CLASSSIZE(MAGCLASSES - 1))
+
+#define MAXCPUS 64
+
+/* rounds per magazine, first and largest */
+#define MAGINIT 8
+#define MAGMAX 64
+
+/* every MAGCHECK depot visits, magazines of the class double if more
+ * than one visit in MAGCONTEND had to wait for the depot lock */
+#define MAGCHECK 256
+#define MAGCONTEND 16
+
+#define FULL 0
+#define EMPTY 1
+
+typedef struct kmag
+{
+  struct kmag* next;      // in a depot list
+  int rounds;             // blocks held
+  int size;               // blocks it can hold
+  void* round[MAGMAX];
+} kmag_t;
+
+/* one class on one CPU, a cache line of its own */
+typedef struct
+{
+  pthread_mutex_t lock;
+  kmag_t* loaded;
+  kmag_t* previous;
+  long long mallocs;
+  long long malloc_misses;  // mallocs passed to the allocator underneath
+  long long frees;
+  long long free_misses;    // frees passed to the allocator underneath
+} __attribute__((aligned(64))) kmag_cpu_t;
+
+typedef struct
+{
+  pthread_mutex_t lock;
+  kmag_t* list[2];          // full and empty magazines
+  int magsize;              // rounds of the magazines handed out now
+  long long gets[2];
+  long long puts[2];
+  long long visits;
+  long long contended;      // visits that waited for the lock
+  long long checked;        // contended at the last resize check
+  int resizes;
+} __attribute__((aligned(64))) kmag_depot_t;
+
+/************Global Variables*********************************************/
+
+/* the allocator underneath in the current run */
+static klayer_base_t base = KLAYER_BASE_INIT;
+
+static int ncpus = 1;
+static kmag_cpu_t cpus[MAXCPUS][MAGCLASSES];
+static kmag_depot_t depot[MAGCLASSES];
+
+/* requests too large to cache */
+static long long passed = 0;
+
+/************Function Prototypes******************************************/
+static void mag_init();
+static void* mag_malloc(kma_size_t);
+static void mag_free(void*, kma_size_t);
+static void mag_stats();
+static void mag_teardown();
+static void mag_flush();
+static kmag_cpu_t* mycpu(int);
+static void depot_lock(kmag_depot_t*);
+static kmag_t* depot_get(int, int);
+static void depot_put(int, int, kmag_t*);
+static void purge(kmag_t*, int);
+static void discard(kmag_t*);
+
+/************External Declaration*****************************************/
+
+static const kma_ops_t mag_ops = { NULL, mag_init, mag_malloc, mag_free,
+				   mag_stats, mag_teardown, KMA_THREADSAFE,
+				   mag_flush };
+
+/**************Implementation***********************************************/
+
+kma_ops_t*
+kmag_wrap(kma_ops_t* base)
+{
+  return layer_wrap(base, MAGSUFFIX, &mag_ops, 0);
+}
+
+static void
+mag_init()
+{
+  int c, cls;
+  
+  layer_init(&base);
+  passed = 0;
+  
+  ncpus = sysconf(_SC_NPROCESSORS_CONF);
+  if (ncpus < 1)
+    {
+      ncpus = 1;
+    }
+  else if (ncpus > MAXCPUS)
+    {
+      ncpus = MAXCPUS;
+    }
+  
+  for (c = 0; c < ncpus; c++)
+    {
+      for (cls = 0; cls < MAGCLASSES; cls++)
+	{
+	  memset(&cpus[c][cls], 0, sizeof(kmag_cpu_t));
+	  pthread_mutex_init(&cpus[c][cls].lock, NULL);
+	}
+    }
+  for (cls = 0; cls < MAGCLASSES; cls++)
+    {
+      memset(&depot[cls], 0, sizeof(kmag_depot_t));
+      pthread_mutex_init(&depot[cls].lock, NULL);
+      depot[cls].magsize = MAGINIT;
+    }
+}
+
+static void*
+mag_malloc(kma_size_t size)
+{
+  kmag_cpu_t* cpu;
+  kmag_t* full;
+  void* res;
+  int cls;
+  
+  if (size > MAGMAXSIZE)
+    {
+      __atomic_fetch_add(&passed, 1, __ATOMIC_RELAXED);
+      return layer_malloc(&base, size);
+    }
+  
+  cls = size_class(size);
+  cpu = mycpu(cls);
+  cpu->mallocs++;
+  
+  if (cpu->loaded == NULL || cpu->loaded->rounds == 0)
+    {
+      if (cpu->previous != NULL && cpu->previous->rounds > 0)
+	{ // previous is full: swap
+	  full = cpu->previous;
+	  cpu->previous = cpu->loaded;
+	  cpu->loaded = full;
+	}
+      else if ((full = depot_get(cls, FULL)) != NULL)
+	{ // both empty: trade previous for a full one
+	  if (cpu->previous != NULL)
+	    {
+	      depot_put(cls, EMPTY, cpu->previous);
+	    }
+	  cpu->previous = cpu->loaded;
+	  cpu->loaded = full;
+	}
+      else
+	{
+	  cpu->malloc_misses++;
+	  pthread_mutex_unlock(&cpu->lock);
+	  return layer_malloc(&base, CLASSSIZE(cls));
+	}
+    }
+  
+  res = cpu->loaded->round[--cpu->loaded->rounds];
+  pthread_mutex_unlock(&cpu->lock);
+  return res;
+}
+
+static void
+mag_free(void* ptr, kma_size_t size)
+{
+  kmag_cpu_t* cpu;
+  kmag_t* empty;
+  int cls;
+  
+  if (size > MAGMAXSIZE)
+    {
+      layer_free(&base, ptr, size);
+      return;
+    }
+  
+  cls = size_class(size);
+  cpu = mycpu(cls);
+  cpu->frees++;
+  
+  if (cpu->loaded == NULL || cpu->loaded->rounds == cpu->loaded->size)
+    {
+      if (cpu->previous != NULL && cpu->previous->rounds == 0)
+	{ // previous is empty: swap
+	  empty = cpu->previous;
+	  cpu->previous = cpu->loaded;
+	  cpu->loaded = empty;
+	}
+      else if ((empty = depot_get(cls, EMPTY)) != NULL)
+	{ // both full: trade previous for an empty one
+	  if (cpu->previous != NULL)
+	    {
+	      depot_put(cls, FULL, cpu->previous);
+	    }
+	  cpu->previous = cpu->loaded;
+	  cpu->loaded = empty;
+	}
+      else
+	{
+	  cpu->free_misses++;
+	  pthread_mutex_unlock(&cpu->lock);
+	  layer_free(&base, ptr, CLASSSIZE(cls));
+	  return;
+	}
+    }
+  
+  cpu->loaded->round[cpu->loaded->rounds++] = ptr;
+  pthread_mutex_unlock(&cpu->lock);
+}
+
+static void
+mag_stats()
+{
+  long long mallocs = 0, mmisses = 0, frees = 0, fmisses = 0;
+  long long gets[2] = { 0, 0 }, puts[2] = { 0, 0 };
+  long long visits = 0, contended = 0;
+  int c, cls, resizes = 0, magsize = 0;
+  
+  for (c = 0; c < ncpus; c++)
+    {
+      for (cls = 0; cls < MAGCLASSES; cls++)
+	{
+	  mallocs += cpus[c][cls].mallocs;
+	  mmisses += cpus[c][cls].malloc_misses;
+	  frees += cpus[c][cls].frees;
+	  fmisses += cpus[c][cls].free_misses;
+	}
+    }
+  for (cls = 0; cls < MAGCLASSES; cls++)
+    {
+      gets[FULL] += depot[cls].gets[FULL];
+      gets[EMPTY] += depot[cls].gets[EMPTY];
+      puts[FULL] += depot[cls].puts[FULL];
+      puts[EMPTY] += depot[cls].puts[EMPTY];
+      visits += depot[cls].visits;
+      contended += depot[cls].contended;
+      resizes += depot[cls].resizes;
+      if (depot[cls].magsize > magsize)
+	{
+	  magsize = depot[cls].magsize;
+	}
+    }
+  
+  printf("Magazines: %.1f%% of %lld mallocs and %.1f%% of %lld frees hit, "
+	 "%lld too large passed through\n",
+	 mallocs ? 100.0 * (mallocs - mmisses) / mallocs : 0.0, mallocs,
+	 frees ? 100.0 * (frees - fmisses) / frees : 0.0, frees, passed);
+  printf("Depot: %lld full and %lld empty magazines taken, %lld full and "
+	 "%lld empty returned, %lld of %lld visits contended, %d resizes "
+	 "(largest %d rounds)\n", gets[FULL], gets[EMPTY], puts[FULL],
+	 puts[EMPTY], contended, visits, resizes, magsize);
+  
+  layer_stats(&base);
+}
+
+static void
+mag_teardown()
+{
+  int c, cls;
+  
+  mag_flush();
+  for (c = 0; c < ncpus; c++)
+    {
+      for (cls = 0; cls < MAGCLASSES; cls++)
+	{
+	  discard(cpus[c][cls].loaded);
+	  discard(cpus[c][cls].previous);
+	  pthread_mutex_destroy(&cpus[c][cls].lock);
+	}
+    }
+  for (cls = 0; cls < MAGCLASSES; cls++)
+    {
+      discard(depot[cls].list[FULL]);
+      discard(depot[cls].list[EMPTY]);
+      pthread_mutex_destroy(&depot[cls].lock);
+    }
+  
+  layer_teardown(&base);
+}
+
+/* the caches belong to CPUs, not threads, so all of them are emptied */
+static void
+mag_flush()
+{
+  kmag_t* mag;
+  int c, cls;
+  
+  for (c = 0; c < ncpus; c++)
+    {
+      for (cls = 0; cls < MAGCLASSES; cls++)
+	{
+	  pthread_mutex_lock(&cpus[c][cls].lock);
+	  purge(cpus[c][cls].loaded, cls);
+	  purge(cpus[c][cls].previous, cls);
+	  pthread_mutex_unlock(&cpus[c][cls].lock);
+	}
+    }
+  for (cls = 0; cls < MAGCLASSES; cls++)
+    {
+      pthread_mutex_lock(&depot[cls].lock);
+      while ((mag = depot[cls].list[FULL]) != NULL)
+	{
+	  depot[cls].list[FULL] = mag->next;
+	  purge(mag, cls);
+	  mag->next = depot[cls].list[EMPTY];
+	  depot[cls].list[EMPTY] = mag;
+	}
+      pthread_mutex_unlock(&depot[cls].lock);
+    }
+  
+  layer_flush(&base);
+}
+
+/* locks and returns the cache of a class on the CPU the caller runs on;
+ * it may migrate right after, which costs locality, not correctness */
+static kmag_cpu_t*
+mycpu(int cls)
+{
+  int c = sched_getcpu();
+  kmag_cpu_t* cpu = &cpus[c < 0 ? 0 : c % ncpus][cls];
+  
+  pthread_mutex_lock(&cpu->lock);
+  return cpu;
+}
+
+/* takes the depot lock, counting waits, and grows the magazines of the
+ * class when too many visits have waited since the last check */
+static void
+depot_lock(kmag_depot_t* d)
+{
+  if (pthread_mutex_trylock(&d->lock) != 0)
+    {
+      pthread_mutex_lock(&d->lock);
+      d->contended++;
+    }
+  
+  if (++d->visits % MAGCHECK == 0)
+    {
+      if (d->contended - d->checked > MAGCHECK / MAGCONTEND
+	  && d->magsize < MAGMAX)
+	{
+	  d->magsize *= 2;
+	  d->resizes++;
+	}
+      d->checked = d->contended;
+    }
+}
+
+/* a full magazine, or an empty one of the current size, new if need be */
+static kmag_t*
+depot_get(int cls, int which)
+{
+  kmag_depot_t* d = &depot[cls];
+  kmag_t* mag;
+  
+  depot_lock(d);
+  mag = d->list[which];
+  if (mag != NULL)
+    {
+      d->list[which] = mag->next;
+      d->gets[which]++;
+    }
+  else if (which == EMPTY)
+    {
+      mag = malloc(sizeof(kmag_t));
+      if (mag != NULL)
+	{
+	  mag->rounds = 0;
+	}
+    }
+  if (mag != NULL)
+    { // a cache holds it alone, and fills an empty one up to the new size
+      mag->next = NULL;
+      if (which == EMPTY)
+	{
+	  mag->size = d->magsize;
+	}
+    }
+  pthread_mutex_unlock(&d->lock);
+  
+  return mag;
+}
+
+static void
+depot_put(int cls, int which, kmag_t* mag)
+{
+  kmag_depot_t* d = &depot[cls];
+  
+  depot_lock(d);
+  mag->next = d->list[which];
+  d->list[which] = mag;
+  d->puts[which]++;
+  pthread_mutex_unlock(&d->lock);
+}
+
+/* gives the rounds of a magazine back to the allocator underneath */
+static void
+purge(kmag_t* mag, int cls)
+{
+  if (mag == NULL)
+    {
+      return;
+    }
+  while (mag->rounds > 0)
+    {
+      layer_free(&base, mag->round[--mag->rounds], CLASSSIZE(cls));
+    }
+}
+
+/* frees a list of empty magazines */
+static void
+discard(kmag_t* mag)
+{
+  kmag_t* next;
+  
+  for (; mag != NULL; mag = next)
+    {
+      next = mag->next;
+      free(mag);
+    }
+}
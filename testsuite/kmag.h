@@ -0,0 +1,54 @@
+/***************************************************************************
+ *  Title: Magazine Layer
+ * -------------------------------------------------------------------------
+ *    Purpose: Bonwick's per-CPU magazines and depot, stacked on top of
+ *             any registered kernel memory allocator
+ *    File: $RCSfile: kmag.h,v $
+ ***************************************************************************/
+
+#ifndef __KMAG_H__
+#define __KMAG_H__
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+#include "kma.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __KMAG_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/* an allocator named base behind magazines is named base MAGSUFFIX */
+#define MAGSUFFIX "+mag"
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Puts magazines in front of an allocator
+ * ---------------------------------------------------------------------
+ *    Purpose: Builds and registers an allocator that caches the blocks
+ *             of base in per-CPU magazines, named after base with
+ *             MAGSUFFIX appended. Only one of them may be in use at a
+ *             time, as for any other allocator.
+ *    Input: the allocator to wrap, itself without magazines
+ *    Output: the new allocator, or NULL if base already has magazines
+ ***********************************************************************/
+EXTERN kma_ops_t* kmag_wrap(kma_ops_t* base);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __KMAG_H__ */
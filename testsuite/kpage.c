@@ -49,6 +49,8 @@
 #include <string.h>
 #include <strings.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <sys/mman.h>
 
 /************Private include**********************************************/
 #include "kpage.h"
@@ -61,16 +63,102 @@
  *  structures and arrays, line everything up in neat columns.
  */
 
+/* the pool is committed in blocks of the largest order */
+#define CHUNKPAGES (1 << (MAXORDER - 1))
+
+/* free blocks that merge up to this order are handed back to the system,
+ * but only beyond the RELEASESLACK most recently freed, so that a caller
+ * cycling one such block does not pay a syscall and a fault each time */
+#define RELEASEORDER (MAXORDER - 1)
+#define RELEASESLACK 2
+
+/*  Concurrent callers share the buddy behind pool_lock. Single pages,
+ *  by far the most requested, mostly skip it: a freed page goes on a
+ *  lock-free stack of up to CACHEPAGES pages that get_pages(0) pops
+ *  first. The stack head packs the top frame, the depth and a
+ *  generation that every push and pop bumps, so a pop that read a head
+ *  which has been popped and pushed back since fails its
+ *  compare-and-swap instead of linking in a stale next (ABA), and one
+ *  compare-and-swap is all a push or a pop costs. Building with
+ *  -DKPAGE_MUTEX leaves the stack out, to price it against the lock.
+ */
+#define CACHEPAGES 256
+
+#define STACKHEAD(frame, n, gen) ((((unsigned long long) (gen) & 0x3fffff) << 42) \
+				  | ((unsigned long long) (n) << 32)	\
+				  | (unsigned int) (frame))
+#define STACKFRAME(head) ((int) ((head) & 0xffffffff))
+#define STACKDEPTH(head) ((int) (((head) >> 32) & 0x3ff))
+#define STACKGEN(head) ((unsigned int) ((head) >> 42))
+
 /************Global Variables*********************************************/
-static kpage_stat_t kpage_stats = { 0, 0, 0, PAGESIZE };
+static kpage_stat_t kpage_stats = { 0, 0, 0, PAGESIZE, 0 };
+const kpage_stat_t* const gpagestats = &kpage_stats;
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#ifndef KPAGE_MUTEX
+// single pages freed and not yet given back to the buddy
+static unsigned long long cache_head = STACKHEAD(-1, 0, 0);
+#endif
 
 static void* pool = NULL;
-static void* next_free_page = NULL;
+static void* reserved = NULL;
+
+// reserved capacity and committed size of the pool, in pages
+static int max_pages = DEFMAXPAGES;
+static int num_pages = 0;
+
+// pages at and above the bump pointer have never been handed out
+static int top = 0;
+
+/*  Frame states. Only the first frame of a block (its head) is FREE,
+ *  USED or CACHED; every other frame is NONE. page_lookup() relies on
+ *  this. A CACHED page is free but on the page stack, not the buddy's
+ *  lists, so the buddy must not merge it.
+ */
+enum FRAME_STATE
+  {
+    NONE,
+    FREE,
+    USED,
+    CACHED
+  };
+
+typedef struct
+{
+  kpage_t page;            // public part handed out by get_pages()
+  enum FRAME_STATE state;
+  int order;               // order of the block headed by this frame
+  int next;                // free list links (frame numbers, -1 ends)
+  int prev;
+  int backed;              // free of RELEASEORDER, not yet given back
+} kframe_t;
+
+// page frame descriptors, one per page of the pool
+static kframe_t* frames = NULL;
+
+// one free list of blocks per order
+static int free_area[MAXORDER];
+
+// free blocks of RELEASEORDER still backed by memory
+static int num_backed = 0;
 
 /************Function Prototypes******************************************/
-void* allocPage();
-void freePage(void*);
+int allocPages(int);
+void freePages(int);
 void initPages();
+int bumpPages(int);
+int commitPages();
+void listAdd(int, int);
+void listDel(int);
+void releasePages();
+void statAdd(int);
+#ifndef KPAGE_MUTEX
+int cachePop();
+int cachePush(int);
+int cacheDrain();
+#endif
 
 /************External Declaration*****************************************/
 
@@ -79,34 +167,179 @@ void initPages();
 kpage_t*
 get_page()
 {
-  static int id = 0;
+  return get_pages(0);
+}
+
+void
+free_page(kpage_t* ptr)
+{
+  free_pages(ptr);
+}
+
+kpage_t*
+get_pages(int order)
+{
   kpage_t* res;
+  int frame = -1;
+  
+  assert(order >= 0 && order < MAXORDER);
   
-  kpage_stats.num_requested++;
-  kpage_stats.num_in_use++;
+#ifndef KPAGE_MUTEX
+  if (order == 0)
+    {
+      frame = cachePop();
+    }
+#endif
+  if (frame == -1)
+    {
+      pthread_mutex_lock(&pool_lock);
+      frame = allocPages(order);
+#ifndef KPAGE_MUTEX
+      if (frame == -1 && cacheDrain() > 0)
+	{ // the cached pages may merge into what the pool is missing
+	  frame = allocPages(order);
+	}
+#endif
+      pthread_mutex_unlock(&pool_lock);
+      if (frame == -1)
+	{
+	  return NULL;
+	}
+    }
   
-  res = (kpage_t*) malloc(sizeof(kpage_t));
-  res->id = id++;
-  res->size = kpage_stats.page_size;
-  res->ptr = allocPage();
+  statAdd(1 << order);
   
-  assert(res->ptr != NULL);
+  // the descriptor lives in the frame table, no heap allocation needed
+  res = &frames[frame].page;
+  res->id = frame;
+  res->size = kpage_stats.page_size << order;
+  res->ptr = pool + (size_t) frame * PAGESIZE;
+  res->count = 0;
   
-  return res;	
+  return res;
 }
 
 void
-free_page(kpage_t* ptr)
+free_pages(kpage_t* ptr)
 {
+  kframe_t* frame = (kframe_t*) ptr;
+  
   assert(ptr != NULL);
   assert(ptr->ptr != NULL);
-  assert(kpage_stats.num_in_use > 0);
+  assert(frame->state == USED);
+  assert(pages_in_use() >= (1 << frame->order));
   
-  kpage_stats.num_freed++;
-  kpage_stats.num_in_use--;
+  __atomic_add_fetch(&kpage_stats.num_freed, 1 << frame->order,
+		     __ATOMIC_RELEASE);
   
-  freePage(ptr->ptr);
-  free(ptr);
+  ptr->ptr = NULL;
+#ifndef KPAGE_MUTEX
+  if (frame->order == 0 && cachePush(frame - frames))
+    {
+      return;
+    }
+#endif
+  pthread_mutex_lock(&pool_lock);
+  freePages(frame - frames);
+  pthread_mutex_unlock(&pool_lock);
+}
+
+int
+get_order(int size)
+{
+  int order = 0;
+  
+  assert(size > 0);
+  
+  size = (size - 1) / PAGESIZE;
+  while (size > 0)
+    {
+      order++;
+      size >>= 1;
+    }
+  
+  return order;
+}
+
+kpage_t*
+page_lookup(void* ptr)
+{
+  int frame, order, head;
+  
+  assert(pool != NULL);
+  assert(ptr >= pool && ptr < pool + (size_t) top * PAGESIZE);
+  
+  frame = (ptr - pool) / PAGESIZE;
+  
+  // the first head found going up the orders is the enclosing block
+  for (order = 0; order < MAXORDER; order++)
+    {
+      head = frame & ~((1 << order) - 1);
+      if (frames[head].state != NONE)
+	{
+	  break;
+	}
+    }
+  
+  assert(order < MAXORDER);
+  assert(frames[head].state == USED);
+  
+  return &frames[head].page;
+}
+
+int
+page_frame(void* ptr)
+{
+  assert(pool != NULL);
+  assert(ptr >= pool && ptr < pool + (size_t) top * PAGESIZE);
+  
+  return (ptr - pool) / PAGESIZE;
+}
+
+int
+page_capacity()
+{
+  pthread_mutex_lock(&pool_lock);
+  if (pool == NULL)
+    {
+      initPages();
+    }
+  pthread_mutex_unlock(&pool_lock);
+  
+  return max_pages;
+}
+
+void
+page_setmax(int pages)
+{
+  assert(pool == NULL);
+  assert(pages > 0);
+  
+  max_pages = pages;
+}
+
+void
+page_teardown()
+{
+  if (pool == NULL)
+    {
+      return;
+    }
+  
+  munmap(reserved, (size_t) max_pages * PAGESIZE + PAGESIZE);
+  munmap(frames, (size_t) max_pages * sizeof(kframe_t));
+  pool = NULL;
+  reserved = NULL;
+  frames = NULL;
+  num_pages = 0;
+  top = 0;
+#ifndef KPAGE_MUTEX
+  cache_head = STACKHEAD(-1, 0, 0);
+#endif
+  
+  kpage_stats.num_requested = 0;
+  kpage_stats.num_freed = 0;
+  kpage_stats.num_peak = 0;
 }
 
 kpage_stat_t*
@@ -114,71 +347,358 @@ page_stats()
 {
   static kpage_stat_t stats;
   
-  return memcpy(&stats, &kpage_stats, sizeof(kpage_stat_t));
+  stats.num_freed = __atomic_load_n(&kpage_stats.num_freed, __ATOMIC_ACQUIRE);
+  stats.num_requested = __atomic_load_n(&kpage_stats.num_requested,
+					__ATOMIC_RELAXED);
+  stats.num_in_use = stats.num_requested - stats.num_freed;
+  stats.page_size = kpage_stats.page_size;
+  stats.num_peak = pages_peak();
+  
+  return &stats;
+}
+
+/*  Counts pages handed out and raises the high-water mark to match.
+ *  Pages in use are requested less freed rather than a counter of
+ *  their own, which would cost every call another atomic add.
+ */
+void
+statAdd(int pages)
+{
+  int cur, peak;
+  
+  cur = __atomic_add_fetch(&kpage_stats.num_requested, pages, __ATOMIC_RELAXED)
+    - __atomic_load_n(&kpage_stats.num_freed, __ATOMIC_RELAXED);
+  
+  peak = pages_peak();
+  while (cur > peak
+	 && !__atomic_compare_exchange_n(&kpage_stats.num_peak, &peak, cur, 1,
+					 __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+#ifndef KPAGE_MUTEX
+/***********************************************************************
+ *  Page stack: a Treiber stack linked through the next field of the
+ *  frames, which the buddy only uses for blocks on its own lists.
+ ***********************************************************************/
+
+int
+cachePop()
+{
+  unsigned long long head;
+  int frame, next;
+  
+  head = __atomic_load_n(&cache_head, __ATOMIC_ACQUIRE);
+  do
+    {
+      frame = STACKFRAME(head);
+      if (frame == -1)
+	{
+	  return -1;
+	}
+      // may be stale if the page went meanwhile; the generation tells
+      next = __atomic_load_n(&frames[frame].next, __ATOMIC_RELAXED);
+    }
+  while (!__atomic_compare_exchange_n(&cache_head, &head,
+				      STACKHEAD(next, STACKDEPTH(head) - 1,
+						STACKGEN(head) + 1), 1,
+				      __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+  
+  __atomic_store_n(&frames[frame].state, USED, __ATOMIC_RELAXED);
+  
+  return frame;
+}
+
+/* pushes a freed page, or returns 0 if the stack is full */
+int
+cachePush(int frame)
+{
+  unsigned long long head;
+  
+  __atomic_store_n(&frames[frame].state, CACHED, __ATOMIC_RELAXED);
+  
+  head = __atomic_load_n(&cache_head, __ATOMIC_RELAXED);
+  do
+    {
+      if (STACKDEPTH(head) == CACHEPAGES)
+	{
+	  __atomic_store_n(&frames[frame].state, USED, __ATOMIC_RELAXED);
+	  return 0;
+	}
+      __atomic_store_n(&frames[frame].next, STACKFRAME(head),
+		       __ATOMIC_RELAXED);
+    }
+  while (!__atomic_compare_exchange_n(&cache_head, &head,
+				      STACKHEAD(frame, STACKDEPTH(head) + 1,
+						STACKGEN(head) + 1), 1,
+				      __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  
+  return 1;
+}
+
+/* gives every cached page back to the buddy; holds pool_lock */
+int
+cacheDrain()
+{
+  int frame, n = 0;
+  
+  while ((frame = cachePop()) != -1)
+    {
+      freePages(frame);
+      n++;
+    }
+  
+  return n;
 }
+#endif
+
+/***********************************************************************
+ *  Binary buddy over the pool: a block of order k is 2^k pages long
+ *  and starts at a frame number that is a multiple of 2^k, so the
+ *  buddy of a block is found by flipping bit k of its frame number.
+ ***********************************************************************/
 
-void*
-allocPage()
+int
+allocPages(int order)
 {
-  void* res;
+  int cur, frame;
   
   if (pool == NULL)
     {
       initPages();
     }
   
-  res = next_free_page;
+  // find the smallest non-empty free list that fits
+  for (cur = order; cur < MAXORDER; cur++)
+    {
+      if (free_area[cur] != -1)
+	{
+	  break;
+	}
+    }
   
-  if (res == NULL)
+  if (cur == MAXORDER)
     {
-      error("error: all pages already allocated", "");
+      // nothing freed fits, take never-used pages instead
+      return bumpPages(order);
     }
   
-  next_free_page = *((void**)next_free_page);
+  frame = free_area[cur];
+  listDel(frame);
+  if (cur >= RELEASEORDER && frames[frame].backed)
+    {
+      frames[frame].backed = 0;
+      num_backed--;
+    }
+  
+  // split down to the requested order, handing back the upper halves
+  while (cur > order)
+    {
+      int buddy;
+      
+      cur--;
+      buddy = frame + (1 << cur);
+      frames[buddy].state = FREE;
+      frames[buddy].order = cur;
+      listAdd(buddy, cur);
+    }
   
-  assert(res != NULL);
+  frames[frame].state = USED;
+  frames[frame].order = order;
   
-  return res;
+  return frame;
 }
 
 void
-freePage(void* ptr)
+freePages(int frame)
 {
-  assert(ptr != NULL);
+  int order = frames[frame].order;
   
-  *((void**)ptr) = next_free_page;
-  next_free_page = ptr;
+  assert(frames[frame].state == USED);
   
-  if (kpage_stats.num_in_use == 0)
+  // coalesce with the buddy for as long as it is free and whole
+  while (order < MAXORDER - 1)
     {
-      free(pool);
-      pool = NULL;
-      next_free_page = NULL;
+      int buddy = frame ^ (1 << order);
+      
+      // a page on the stack changes state without the lock
+      if (__atomic_load_n(&frames[buddy].state, __ATOMIC_RELAXED) != FREE
+	  || frames[buddy].order != order)
+	{
+	  break;
+	}
+      
+      listDel(buddy);
+      frames[buddy].state = NONE;
+      frames[frame].state = NONE;
+      
+      frame &= buddy;
+      order++;
+    }
+  
+  frames[frame].state = FREE;
+  frames[frame].order = order;
+  listAdd(frame, order);
+  
+  if (order >= RELEASEORDER)
+    {
+      frames[frame].backed = 1;
+      if (++num_backed > RELEASESLACK)
+	{
+	  releasePages();
+	}
+    }
+}
+
+/* hands back every backed free block of RELEASEORDER but the first
+ * RELEASESLACK on its list, which are the most recently freed */
+void
+releasePages()
+{
+  int frame, kept = 0;
+  
+  for (frame = free_area[RELEASEORDER]; frame != -1;
+       frame = frames[frame].next)
+    {
+      if (!frames[frame].backed || kept++ < RELEASESLACK)
+	{
+	  continue;
+	}
+      // nothing in here is live anymore, let the system reclaim it
+      madvise(pool + (size_t) frame * PAGESIZE, PAGESIZE << RELEASEORDER,
+	      MADV_DONTNEED);
+      frames[frame].backed = 0;
+      num_backed--;
     }
 }
 
 void
 initPages()
 {
+  char* env;
   int i;
   
-  assert(next_free_page == NULL);
   assert(pool == NULL);
   
-  //pool = calloc(MAXPAGES, PAGESIZE);
-  int result = posix_memalign(&pool, PAGESIZE, MAXPAGES * PAGESIZE);
-  if(result)
-    error("Error using posix_memalign to allocate memory", "");
-  next_free_page = pool;
+  env = getenv("KMA_MAXPAGES");
+  if (env != NULL && atoi(env) > 0)
+    {
+      max_pages = atoi(env);
+    }
   
-  // use ptr to point to the next free page struct
-  for (i = 0; i < (MAXPAGES - 1); i++)
+  // whole chunks only, at least one
+  max_pages &= ~(CHUNKPAGES - 1);
+  if (max_pages == 0)
     {
-      void* ptr = (pool + i * PAGESIZE);
-      void* next = ptr + PAGESIZE;
-      
-      *((void**) ptr) = next;
+      max_pages = CHUNKPAGES;
+    }
+  
+  // reserve address space only, pages get committed by commitPages()
+  reserved = mmap(NULL, (size_t) max_pages * PAGESIZE + PAGESIZE, PROT_NONE,
+		  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (reserved == MAP_FAILED)
+    error("Error using mmap to reserve the page pool", "");
+  pool = BASEADDR(reserved + PAGESIZE - 1);
+  
+  // descriptors are touched (and so backed) only as pages get used
+  frames = mmap(NULL, (size_t) max_pages * sizeof(kframe_t),
+		PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (frames == MAP_FAILED)
+    error("Error using mmap to allocate the page frame table", "");
+  
+  num_pages = 0;
+  top = 0;
+  num_backed = 0;
+  for (i = 0; i < MAXORDER; i++)
+    {
+      free_area[i] = -1;
+    }
+}
+
+int
+bumpPages(int order)
+{
+  int frame, cur;
+  
+  // blocks must be aligned to their size
+  frame = (top + (1 << order) - 1) & ~((1 << order) - 1);
+  
+  while (frame + (1 << order) > num_pages)
+    {
+      if (!commitPages())
+	{
+	  return -1;
+	}
+    }
+  
+  // the pages skipped for alignment go on the free lists as blocks
+  for (cur = 0; top < frame; cur++)
+    {
+      if (top & (1 << cur))
+	{
+	  frames[top].state = FREE;
+	  frames[top].order = cur;
+	  listAdd(top, cur);
+	  top += 1 << cur;
+	}
+    }
+  
+  top = frame + (1 << order);
+  
+  frames[frame].state = USED;
+  frames[frame].order = order;
+  
+  return frame;
+}
+
+int
+commitPages()
+{
+  if (num_pages + CHUNKPAGES > max_pages)
+    {
+      return 0;
+    }
+  
+  if (mprotect(pool + (size_t) num_pages * PAGESIZE,
+	       (size_t) CHUNKPAGES * PAGESIZE, PROT_READ | PROT_WRITE) != 0)
+    {
+      return 0;
     }
+  num_pages += CHUNKPAGES;
+  
+  return 1;
+}
+
+void
+listAdd(int frame, int order)
+{
+  int head = free_area[order];
   
-  *((void**)(pool + (MAXPAGES - 1) * PAGESIZE)) = NULL;
+  frames[frame].prev = -1;
+  frames[frame].next = head;
+  if (head != -1)
+    {
+      frames[head].prev = frame;
+    }
+  free_area[order] = frame;
+}
+
+void
+listDel(int frame)
+{
+  kframe_t* cur = &frames[frame];
+  
+  if (cur->prev != -1)
+    {
+      frames[cur->prev].next = cur->next;
+    }
+  else
+    {
+      free_area[cur->order] = cur->next;
+    }
+  
+  if (cur->next != -1)
+    {
+      frames[cur->next].prev = cur->prev;
+    }
 }
@@ -0,0 +1,528 @@
+/***************************************************************************
+ *  Title: Per-CPU Caches
+ * -------------------------------------------------------------------------
+ *    Purpose: Per-CPU free block caches kept with restartable sequences,
+ *             or per-thread ones, stacked on top of any registered
+ *             kernel memory allocator. A CPU keeps up to PCCAP free
+ *             blocks per class in an array; a push or pop reads the
+ *             CPU number from the rseq area the C library registered,
+ *             then commits with a single store of the new count. If the
+ *             thread is preempted or migrated in between, the kernel
+ *             sends it to the abort handler and the operation is tried
+ *             again, so the fast path has no atomic read-modify-write
+ *             and no lock. However many threads share a CPU, they share
+ *             its cache. Where rseq is missing, each thread keeps its
+ *             own lists instead, given back when it exits.
+ *    File: $RCSfile: kpcpu.c,v $
+ ***************************************************************************/
+#define __KPCPU_IMPL__
+
+/************System include***********************************************/
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#if defined(__x86_64__) && defined(__has_include)
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#define HAVE_RSEQ
+#endif
+#endif
+
+/************Private include**********************************************/
+#include "kpage.h"
+#include "kclass.h"
+#include "kma.h"
+#include "klayer.h"
+#include "kpcpu.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/*  Requests are rounded up to a power-of-two class, as in kmag.c, and
+ *  the whole page goes straight to the allocator underneath.
+ */
+#define PCCLASSES (NUMCLASSES - 1)
+#define PCMAXSIZE (CLASSSIZE(PCCLASSES - 1))
+
+/* free blocks a CPU or thread keeps per class, and how many a refill
+ * brings or a spill takes away */
+#define PCCAP 32
+#define PCBATCH (PCCAP / 2)
+
+/* what a restartable sequence ended with */
+#define RSEQ_DONE 0
+#define RSEQ_MISS 1     // nothing to pop, or no room to push
+#define RSEQ_ABORT 2    // preempted or migrated: try again
+
+typedef struct
+{
+  long count[PCCLASSES];
+  void* slot[PCCLASSES][PCCAP];
+} __attribute__((aligned(64))) kpc_cpu_t;
+
+#ifdef HAVE_RSEQ
+#define RSEQAREA() ((struct rseq*) ((char*) __builtin_thread_pointer()	\
+				    + __rseq_offset))
+
+/*  The critical section runs from label 1 to label 2, the instruction
+ *  after the committing store. Its descriptor goes to the __rseq_cs
+ *  section and is published in the rseq area first; the abort handler
+ *  at label 4 must follow the signature the C library registered,
+ *  which is hidden in a ud1 instruction as the kernel ABI suggests.
+ */
+#define RSEQ_ENTER							\
+  ".pushsection __rseq_cs, \"aw\"\n\t"					\
+  ".balign 32\n\t"							\
+  "3:\n\t"								\
+  ".long 0, 0\n\t"							\
+  ".quad 1f, 2f - 1f, 4f\n\t"						\
+  ".popsection\n\t"							\
+  "leaq 3b(%%rip), %%rax\n\t"						\
+  "movq %%rax, %c[csoff](%[rs])\n\t"					\
+  "1:\n\t"								\
+  "movl %c[cpuoff](%[rs]), %%eax\n\t"					\
+  "imulq %[stride], %%rax\n\t"						\
+  "addq %[cpus], %%rax\n\t"
+
+#define RSEQ_LEAVE							\
+  "2:\n\t"								\
+  ".pushsection __rseq_failure, \"ax\"\n\t"				\
+  ".byte 0x0f, 0xb9, 0x3d\n\t"						\
+  ".long %c[sig]\n\t"							\
+  "4:\n\t"								\
+  "jmp %l[abort]\n\t"							\
+  ".popsection\n\t"
+
+#define RSEQ_INPUTS							\
+  [rs] "r" (RSEQAREA()),						\
+  [csoff] "i" (offsetof(struct rseq, rseq_cs)),				\
+  [cpuoff] "i" (offsetof(struct rseq, cpu_id)),				\
+  [sig] "i" (RSEQ_SIG),							\
+  [stride] "r" ((long) sizeof(kpc_cpu_t)),				\
+  [cpus] "r" (cpus)
+#endif
+
+/************Global Variables*********************************************/
+
+/* the allocator underneath in the current run */
+static klayer_base_t base = KLAYER_BASE_INIT;
+
+/* whether the current run was asked to cache per CPU, whether it does,
+ * and the caches if so, one per CPU id the kernel may report */
+static bool wanted = FALSE;
+static bool percpu = FALSE;
+static kpc_cpu_t* cpus = NULL;
+static int ncpus = 0;
+
+/* this thread's free blocks per class, linked through their first word */
+static __thread void* tchead[PCCLASSES];
+static __thread int tccount[PCCLASSES];
+
+/* set in every thread that cached something, to flush it on exit */
+static pthread_key_t tckey;
+
+/* slow path counters, updated with atomics */
+static struct
+{
+  long long refills;   // empty caches filled from the allocator underneath
+  long long spills;    // full caches emptied into it
+  long long restarts;  // restartable sequences aborted
+  long long passed;    // requests too large to cache
+} pcstats;
+
+/************Function Prototypes******************************************/
+static void pc_init();
+static void* pc_malloc(kma_size_t);
+static void pc_free(void*, kma_size_t);
+static void pc_stats();
+static void pc_teardown();
+static void pc_flush();
+static void* refill(int);
+static void spill(void*, int);
+static bool cache_pop(int, void**);
+static bool cache_push(int, void*);
+static void tcdrain();
+static void tcexit(void*);
+static int possible_cpus();
+#ifdef HAVE_RSEQ
+static inline int rseq_pop(int, void**);
+static inline int rseq_push(int, void*);
+#endif
+
+/************External Declaration*****************************************/
+
+static const kma_ops_t pc_ops = { NULL, pc_init, pc_malloc, pc_free, pc_stats,
+				  pc_teardown, KMA_THREADSAFE, pc_flush };
+
+/**************Implementation***********************************************/
+
+/* the layer option is whether to cache per CPU where rseq allows */
+kma_ops_t*
+kpcpu_wrap(kma_ops_t* base)
+{
+  return layer_wrap(base, PCPUSUFFIX, &pc_ops, TRUE);
+}
+
+kma_ops_t*
+kpcpu_wrap_thread(kma_ops_t* base)
+{
+  return layer_wrap(base, TCACHESUFFIX, &pc_ops, FALSE);
+}
+
+static void
+pc_init()
+{
+  wanted = layer_init(&base)->option;
+  memset(&pcstats, 0, sizeof(pcstats));
+  
+  percpu = FALSE;
+#ifdef HAVE_RSEQ
+  // the C library registers an rseq area in every thread unless the
+  // kernel lacks rseq or the glibc.pthread.rseq tunable turned it off
+  if (wanted && __rseq_size > 0 && (ncpus = possible_cpus()) > 0)
+    {
+      cpus = aligned_alloc(64, ncpus * sizeof(kpc_cpu_t));
+      percpu = cpus != NULL;
+      if (percpu)
+	{
+	  memset(cpus, 0, ncpus * sizeof(kpc_cpu_t));
+	}
+    }
+#endif
+  if (!percpu)
+    {
+      pthread_key_create(&tckey, tcexit);
+    }
+}
+
+static void*
+pc_malloc(kma_size_t size)
+{
+  void* res;
+  
+  if (size > PCMAXSIZE)
+    {
+      __atomic_fetch_add(&pcstats.passed, 1, __ATOMIC_RELAXED);
+      return layer_malloc(&base, size);
+    }
+  
+  if (cache_pop(size_class(size), &res))
+    {
+      return res;
+    }
+  return refill(size_class(size));
+}
+
+static void
+pc_free(void* ptr, kma_size_t size)
+{
+  if (size > PCMAXSIZE)
+    {
+      layer_free(&base, ptr, size);
+      return;
+    }
+  
+  if (!cache_push(size_class(size), ptr))
+    {
+      spill(ptr, size_class(size));
+    }
+}
+
+static void
+pc_stats()
+{
+  printf("%s caches%s: %lld refills and %lld spills of up to %d blocks, "
+	 "%lld restarts, %lld too large passed through\n",
+	 percpu ? "Per-CPU" : "Per-thread",
+	 percpu ? " (rseq)" : wanted ?
+	 " (rseq unavailable)" : "", pcstats.refills, pcstats.spills,
+	 PCBATCH, pcstats.restarts, pcstats.passed);
+  
+  layer_stats(&base);
+}
+
+static void
+pc_teardown()
+{
+  pc_flush();
+  if (percpu)
+    {
+      free(cpus);
+      cpus = NULL;
+    }
+  else
+    {
+      // the other threads have exited, and flushed, by now
+      pthread_key_delete(tckey);
+    }
+  
+  layer_teardown(&base);
+}
+
+/* with per-CPU caches every CPU's, with per-thread caches the calling
+ * thread's; then whatever the allocator underneath caches. Only called
+ * while no other thread uses the allocator, as for any flush. */
+static void
+pc_flush()
+{
+  int c, cls;
+  
+  if (percpu)
+    {
+      layer_lock(&base);
+      for (c = 0; c < ncpus; c++)
+	{
+	  for (cls = 0; cls < PCCLASSES; cls++)
+	    {
+	      while (cpus[c].count[cls] > 0)
+		{
+		  base.ops->free(cpus[c].slot[cls][--cpus[c].count[cls]],
+				 CLASSSIZE(cls));
+		}
+	    }
+	}
+      layer_unlock(&base);
+    }
+  tcdrain();
+  
+  layer_flush(&base);
+}
+
+/* takes a batch from the allocator underneath, returns one block of it
+ * and caches the rest */
+static void*
+refill(int cls)
+{
+  void* block[PCBATCH];
+  int i, n;
+  
+  __atomic_fetch_add(&pcstats.refills, 1, __ATOMIC_RELAXED);
+  
+  layer_lock(&base);
+  for (n = 0; n < PCBATCH; n++)
+    {
+      block[n] = base.ops->malloc(CLASSSIZE(cls));
+      if (block[n] == NULL)
+	{
+	  break;
+	}
+    }
+  layer_unlock(&base);
+  
+  // the CPU may have changed, and its cache filled, in the meantime
+  for (i = 1; i < n && cache_push(cls, block[i]); i++)
+    {
+    }
+  if (i < n)
+    {
+      layer_lock(&base);
+      for (; i < n; i++)
+	{
+	  base.ops->free(block[i], CLASSSIZE(cls));
+	}
+      layer_unlock(&base);
+    }
+  
+  return n > 0 ? block[0] : NULL;
+}
+
+/* frees a block that found its cache full, along with a batch of it */
+static void
+spill(void* ptr, int cls)
+{
+  void* block[PCBATCH];
+  int n;
+  
+  __atomic_fetch_add(&pcstats.spills, 1, __ATOMIC_RELAXED);
+  block[0] = ptr;
+  for (n = 1; n < PCBATCH && cache_pop(cls, &block[n]); n++)
+    {
+    }
+  
+  layer_lock(&base);
+  while (n > 0)
+    {
+      base.ops->free(block[--n], CLASSSIZE(cls));
+    }
+  layer_unlock(&base);
+}
+
+/* pops a cached block of a class, FALSE if there is none */
+static bool
+cache_pop(int cls, void** res)
+{
+#ifdef HAVE_RSEQ
+  if (percpu)
+    {
+      int r;
+  
+      while ((r = rseq_pop(cls, res)) == RSEQ_ABORT)
+	{
+	  __atomic_fetch_add(&pcstats.restarts, 1, __ATOMIC_RELAXED);
+	}
+      return r == RSEQ_DONE;
+    }
+#endif
+  if (tccount[cls] == 0)
+    {
+      return FALSE;
+    }
+  *res = tchead[cls];
+  tchead[cls] = *(void**)*res;
+  tccount[cls]--;
+  return TRUE;
+}
+
+/* caches a block of a class, FALSE if there is no room */
+static bool
+cache_push(int cls, void* ptr)
+{
+#ifdef HAVE_RSEQ
+  if (percpu)
+    {
+      int r;
+  
+      while ((r = rseq_push(cls, ptr)) == RSEQ_ABORT)
+	{
+	  __atomic_fetch_add(&pcstats.restarts, 1, __ATOMIC_RELAXED);
+	}
+      return r == RSEQ_DONE;
+    }
+#endif
+  if (tccount[cls] == PCCAP)
+    {
+      return FALSE;
+    }
+  if (tccount[cls] == 0 && pthread_getspecific(tckey) == NULL)
+    { // refilled or freed into, this thread flushes its lists on exit
+      pthread_setspecific(tckey, (void*) 1);
+    }
+  *(void**)ptr = tchead[cls];
+  tchead[cls] = ptr;
+  tccount[cls]++;
+  return TRUE;
+}
+
+/* gives this thread's cached blocks back to the allocator underneath */
+static void
+tcdrain()
+{
+  int cls;
+  
+  layer_lock(&base);
+  for (cls = 0; cls < PCCLASSES; cls++)
+    {
+      for (; tccount[cls] > 0; tccount[cls]--)
+	{
+	  void* ptr = tchead[cls];
+  
+	  tchead[cls] = *(void**)ptr;
+	  base.ops->free(ptr, CLASSSIZE(cls));
+	}
+    }
+  layer_unlock(&base);
+}
+
+/* other threads may still run, so only this thread's lists go back */
+static void
+tcexit(void* unused)
+{
+  tcdrain();
+}
+
+/*  The kernel numbers CPUs up to the highest one that may ever come
+ *  online, which can exceed the CPUs configured now when ids are sparse
+ *  or CPUs get hot-added, and rseq_pop() and rseq_push() index the
+ *  caches by that number unchecked. Returns one past the highest id
+ *  possible, or 0 if it cannot tell.
+ */
+static int
+possible_cpus()
+{
+  FILE* f = fopen("/sys/devices/system/cpu/possible", "r");
+  int id, max = -1;
+  
+  if (f == NULL)
+    {
+      return 0;
+    }
+  // a list of ids and ranges such as 0-3,8-11
+  while (fscanf(f, "%d%*[-,]", &id) == 1)
+    {
+      if (id > max)
+	{
+	  max = id;
+	}
+    }
+  fclose(f);
+  
+  return max + 1;
+}
+
+#ifdef HAVE_RSEQ
+/* pops the top block of a class from the running CPU's cache */
+static inline int
+rseq_pop(int cls, void** res)
+{
+  __asm__ goto (RSEQ_ENTER
+		"movq (%%rax,%[count]), %%rcx\n\t"
+		"testq %%rcx, %%rcx\n\t"
+		"jz %l[miss]\n\t"
+		"leaq (%%rax,%[slot]), %%rdx\n\t"
+		"movq -8(%%rdx,%%rcx,8), %%rdx\n\t"
+		"movq %%rdx, (%[res])\n\t"
+		"decq %%rcx\n\t"
+		"movq %%rcx, (%%rax,%[count])\n\t"
+		RSEQ_LEAVE
+		:
+		: RSEQ_INPUTS,
+		  [count] "r" (cls * sizeof(long)),
+		  [slot] "r" (offsetof(kpc_cpu_t, slot)
+			      + cls * PCCAP * sizeof(void*)),
+		  [res] "r" (res)
+		: "rax", "rcx", "rdx", "memory", "cc"
+		: miss, abort);
+  return RSEQ_DONE;
+ miss:
+  return RSEQ_MISS;
+ abort:
+  return RSEQ_ABORT;
+}
+
+/* pushes a block of a class on the running CPU's cache */
+static inline int
+rseq_push(int cls, void* ptr)
+{
+  __asm__ goto (RSEQ_ENTER
+		"movq (%%rax,%[count]), %%rcx\n\t"
+		"cmpq %[cap], %%rcx\n\t"
+		"jae %l[miss]\n\t"
+		"leaq (%%rax,%[slot]), %%rdx\n\t"
+		"movq %[ptr], (%%rdx,%%rcx,8)\n\t"
+		"incq %%rcx\n\t"
+		"movq %%rcx, (%%rax,%[count])\n\t"
+		RSEQ_LEAVE
+		:
+		: RSEQ_INPUTS,
+		  [count] "r" (cls * sizeof(long)),
+		  [slot] "r" (offsetof(kpc_cpu_t, slot)
+			      + cls * PCCAP * sizeof(void*)),
+		  [ptr] "r" (ptr),
+		  [cap] "i" (PCCAP)
+		: "rax", "rcx", "rdx", "memory", "cc"
+		: miss, abort);
+  return RSEQ_DONE;
+ miss:
+  return RSEQ_MISS;
+ abort:
+  return RSEQ_ABORT;
+}
+#endif
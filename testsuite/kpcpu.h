@@ -0,0 +1,68 @@
+/***************************************************************************
+ *  Title: Per-CPU Caches
+ * -------------------------------------------------------------------------
+ *    Purpose: Per-CPU free block caches kept with restartable sequences,
+ *             or per-thread ones, stacked on top of any registered
+ *             kernel memory allocator
+ *    File: $RCSfile: kpcpu.h,v $
+ ***************************************************************************/
+
+#ifndef __KPCPU_H__
+#define __KPCPU_H__
+
+/************System include***********************************************/
+
+/************Private include**********************************************/
+#include "kma.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#undef EXTERN
+#ifdef __KPCPU_IMPL__
+#define EXTERN
+#else
+#define EXTERN extern
+#endif
+
+/* an allocator named base behind per-CPU caches is named base PCPUSUFFIX,
+ * behind per-thread ones base TCACHESUFFIX */
+#define PCPUSUFFIX "+pcpu"
+#define TCACHESUFFIX "+tcache"
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+
+/***********************************************************************
+ *  Title: Puts per-CPU caches in front of an allocator
+ * ---------------------------------------------------------------------
+ *    Purpose: Builds and registers an allocator that caches the blocks
+ *             of base per CPU, updated with restartable sequences and
+ *             so without atomic instructions or locks. Where the
+ *             kernel or the C library offers no rseq it caches per
+ *             thread instead.
+ *    Input: the allocator to wrap, itself without these caches
+ *    Output: the new allocator, or NULL if base already has them
+ ***********************************************************************/
+EXTERN kma_ops_t* kpcpu_wrap(kma_ops_t* base);
+
+/***********************************************************************
+ *  Title: Puts per-thread caches in front of an allocator
+ * ---------------------------------------------------------------------
+ *    Purpose: As kpcpu_wrap(), but always caches per thread, which is
+ *             the fallback kpcpu_wrap() measures against
+ *    Input: the allocator to wrap, itself without these caches
+ *    Output: the new allocator, or NULL if base already has them
+ ***********************************************************************/
+EXTERN kma_ops_t* kpcpu_wrap_thread(kma_ops_t* base);
+
+/************External Declaration*****************************************/
+
+/**************Definition***************************************************/
+
+#endif /* __KPCPU_H__ */
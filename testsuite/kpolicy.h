@@ -0,0 +1,643 @@
+/***************************************************************************
+ *  Title: Policy Allocator
+ * -------------------------------------------------------------------------
+ *    Purpose: Generates a segregated-fit allocator from compile-time
+ *             policies, one variant per inclusion
+ *    File: $RCSfile: kpolicy.h,v $
+ ***************************************************************************/
+/*  A variant picks its policies with #defines and includes this file:
+ *
+ *    #define KP_NAME    mck2           name in the registry and prefix of
+ *                                      every symbol of the variant
+ *    #define KP_CLASSES KP_POW2        size classes: KP_POW2 or KP_FINE
+ *    #define KP_SLAB    0              order of the page block a slab is
+ *                                      carved from (0 is a single page)
+ *    #define KP_META    KP_META_TABLE  where the live count of a slab is
+ *                                      kept: KP_META_PAGE in the page
+ *                                      descriptor, KP_META_TABLE in a
+ *                                      table indexed by frame number
+ *    #define KP_LOCK    KP_LOCK_NONE   KP_LOCK_NONE or KP_LOCK_MUTEX
+ *    #define KP_TCACHE  0              free blocks each thread may keep
+ *                                      per class, 0 for no thread cache;
+ *                                      needs KP_LOCK_MUTEX
+ *    #define KP_TCLIMIT(c) ...         the same per class, by default
+ *                                      KP_TCACHE up to 1 KB blocks and
+ *                                      fewer, 1 KB worth, above
+ *    #include "kpolicy.h"
+ *
+ *  Only KP_NAME is required. The policies are constants, so the
+ *  preprocessor drops whatever a variant does not use and every variant
+ *  gets its own straight-line fast path; the one indirect call left is
+ *  the kma_ops_t dispatch that every allocator pays. The file #undefs
+ *  its parameters at the end, so several variants can share a file.
+ *
+ *  Requests up to KP_MAXSMALL (half a page unless defined) come from
+ *  slabs holding blocks of one class; larger ones get whole pages. With
+ *  KP_META_PAGE free() tells the two apart by size, with KP_META_TABLE
+ *  by the table, which also records the class of every slab page. The
+ *  table stays until teardown, and each class keeps its last idle slab as
+ *  a spare, given back by flush, so that a heap hovering around a single
+ *  live block neither remaps the table nor gets and frees a slab per
+ *  round trip.
+ *
+ *  With KP_TCACHE every thread keeps up to KP_TCLIMIT(c) free blocks of
+ *  class c in a list of its own, so malloc() and free() of small blocks
+ *  take no lock and no atomic while the list has blocks or room. An
+ *  empty list is refilled and a full one half emptied in one batch
+ *  under the lock. Cached blocks count as allocated for their slabs;
+ *  the thread gives them back when it exits, or through flush.
+ */
+
+/************System include***********************************************/
+#include <assert.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <pthread.h>
+
+/************Private include**********************************************/
+#include "kpage.h"
+#include "kma.h"
+#include "kclass.h"
+#include "klist.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+#ifndef __KPOLICY_H__
+#define __KPOLICY_H__
+
+#define KP_POW2 0
+#define KP_FINE 1
+
+#define KP_META_PAGE 0
+#define KP_META_TABLE 1
+
+#define KP_LOCK_NONE 0
+#define KP_LOCK_MUTEX 1
+
+/* table class of the first page of a large block */
+#define KP_LARGE 0xff
+
+#define KP_CAT(a, b) KP_CAT2(a, b)
+#define KP_CAT2(a, b) a##b
+#define KP_STR(a) KP_STR2(a)
+#define KP_STR2(a) #a
+
+typedef struct
+{
+  unsigned char cls;     // class of the slab the page belongs to
+  unsigned short count;  // live blocks, kept on the first page only
+} kp_meta_t;
+
+#endif /* __KPOLICY_H__ */
+
+#ifndef KP_NAME
+#error "KP_NAME must name the variant"
+#endif
+#ifndef KP_CLASSES
+#define KP_CLASSES KP_POW2
+#endif
+#ifndef KP_SLAB
+#define KP_SLAB 0
+#endif
+#ifndef KP_META
+#define KP_META KP_META_PAGE
+#endif
+#ifndef KP_LOCK
+#define KP_LOCK KP_LOCK_NONE
+#endif
+#ifndef KP_MAXSMALL
+#define KP_MAXSMALL (PAGESIZE / 2)
+#endif
+#ifndef KP_TCACHE
+#define KP_TCACHE 0
+#endif
+#ifndef KP_TCLIMIT
+#define KP_TCLIMIT(c) (KP_SIZE(c) <= 1024 ? KP_TCACHE			\
+		       : KP_TCACHE * 1024 / KP_SIZE(c))
+#endif
+
+#if KP_SLAB < 0 || KP_SLAB > 6
+#error "KP_SLAB must keep a slab's block count within an unsigned short"
+#endif
+#if KP_TCACHE > 0 && KP_LOCK != KP_LOCK_MUTEX
+#error "KP_TCACHE batches under the lock, it needs KP_LOCK_MUTEX"
+#endif
+
+/* symbols of this variant */
+#define KP_(x) KP_CAT(KP_NAME, KP_CAT(_, x))
+
+#if KP_CLASSES == KP_POW2
+#define KP_NUMCLASSES NUMCLASSES
+#define KP_CLASS(size) size_class(size)
+#define KP_SIZE(c) CLASSSIZE(c)
+#else
+#define KP_NUMCLASSES NUMFINECLASSES
+#define KP_CLASS(size) fine_class(size)
+#define KP_SIZE(c) FINESIZE(c)
+#endif
+
+#define KP_SLABSIZE (PAGESIZE << KP_SLAB)
+#define KP_OBJS(c) (KP_SLABSIZE / KP_SIZE(c))
+
+/* frame of the first page of the slab holding ptr */
+#define KP_HEAD(ptr) (page_frame(ptr) & ~((1 << KP_SLAB) - 1))
+
+/* live blocks of the slab starting at base */
+#if KP_META == KP_META_TABLE
+#define KP_COUNT(base) (KP_(meta)[page_frame(base)].count)
+#else
+#define KP_COUNT(base) (page_lookup(base)->count)
+#endif
+
+/* blocks moved between a thread cache and the class list at once */
+#define KP_TCBATCH(c) ((KP_TCLIMIT(c) + 1) / 2)
+
+#if KP_LOCK == KP_LOCK_MUTEX
+#define KP_ENTER() pthread_mutex_lock(&KP_(lock))
+#define KP_LEAVE() pthread_mutex_unlock(&KP_(lock))
+#else
+#define KP_ENTER()
+#define KP_LEAVE()
+#endif
+
+/************Global Variables*********************************************/
+
+/* one free list per class */
+static klist_t KP_(lists)[KP_NUMCLASSES];
+
+/* the slab of each class last found idle, kept instead of released */
+static void* KP_(spare)[KP_NUMCLASSES];
+
+#if KP_META == KP_META_TABLE
+/* one entry per page frame of the pool, backed only where touched */
+static kp_meta_t* KP_(meta) = NULL;
+static int KP_(nmeta) = 0;
+#endif
+
+#if KP_LOCK == KP_LOCK_MUTEX
+static pthread_mutex_t KP_(lock) = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+#if KP_TCACHE > 0
+/* this thread's free blocks per class, linked through their first word */
+static __thread void* KP_(tchead)[KP_NUMCLASSES];
+static __thread int KP_(tccount)[KP_NUMCLASSES];
+
+/* set in every thread that cached something, to flush it on exit */
+static pthread_key_t KP_(tckey);
+#endif
+
+/************Function Prototypes******************************************/
+static void KP_(init)();
+static void* KP_(malloc)(kma_size_t);
+static void KP_(free)(void*, kma_size_t);
+static void KP_(teardown)();
+static void KP_(flush)();
+static void* KP_(get)(int);
+static void KP_(put)(void*, int);
+static void* KP_(large)(kma_size_t);
+static int KP_(refill)(int);
+static void KP_(release)(void*, int);
+#if KP_META == KP_META_TABLE
+static void KP_(metainit)();
+static void KP_(metafini)();
+#endif
+#if KP_TCACHE > 0
+static inline void KP_(tcpush)(void*, int);
+static inline void* KP_(tcpop)(int);
+static void KP_(tcregister)();
+static void* KP_(tcfill)(int);
+static void KP_(tcflush)(int, int);
+static void KP_(tcdrain)();
+static void KP_(tcexit)(void*);
+#endif
+
+/************External Declaration*****************************************/
+
+static kma_ops_t KP_(ops) = { KP_STR(KP_NAME), KP_(init), KP_(malloc),
+			      KP_(free), NULL, KP_(teardown),
+			      KP_LOCK == KP_LOCK_MUTEX ? KMA_THREADSAFE : 0,
+			      KP_(flush) };
+
+/* KMA_REGISTER pastes its argument, which would keep KP_() unexpanded */
+static void __attribute__((constructor))
+KP_(register)()
+{
+  kma_register(&KP_(ops));
+}
+
+/**************Implementation***********************************************/
+
+static void
+KP_(init)()
+{
+  int i;
+  
+  for (i = 0; i < KP_NUMCLASSES; i++)
+    {
+      klist_init(&KP_(lists)[i]);
+      KP_(spare)[i] = NULL;
+    }
+#if KP_TCACHE > 0
+  pthread_key_create(&KP_(tckey), KP_(tcexit));
+#endif
+}
+
+static void
+KP_(teardown)()
+{
+  // the other threads have exited, and flushed, by now
+  KP_(flush)();
+#if KP_TCACHE > 0
+  pthread_key_delete(KP_(tckey));
+#endif
+#if KP_META == KP_META_TABLE
+  if (KP_(meta) != NULL)
+    {
+      KP_(metafini)();
+    }
+#endif
+}
+
+static void*
+KP_(malloc)(kma_size_t size)
+{
+  void* res;
+  int cls;
+  
+  if (size > KP_MAXSMALL)
+    {
+      return KP_(large)(size);
+    }
+  
+  cls = KP_CLASS(size);
+  
+#if KP_TCACHE > 0
+  if (KP_(tccount)[cls] > 0)
+    {
+      return KP_(tcpop)(cls);
+    }
+  if (KP_TCLIMIT(cls) > 0)
+    {
+      return KP_(tcfill)(cls);
+    }
+#endif
+  
+  KP_ENTER();
+  res = KP_(get)(cls);
+  KP_LEAVE();
+  
+  return res;
+}
+
+static void
+KP_(free)(void* ptr, kma_size_t size)
+{
+#if KP_TCACHE > 0
+  // malloc() chose small or large by size alone, so free() can too
+  int tc = size <= KP_MAXSMALL ? KP_CLASS(size) : 0;
+  
+  if (size <= KP_MAXSMALL && KP_TCLIMIT(tc) > 0)
+    {
+      if (KP_(tccount)[tc] == 0)
+	{ // a thread may only ever free, and never fill
+	  KP_(tcregister)();
+	}
+      else if (KP_(tccount)[tc] >= KP_TCLIMIT(tc))
+	{
+	  KP_(tcflush)(tc, KP_TCBATCH(tc));
+	}
+      KP_(tcpush)(ptr, tc);
+      return;
+    }
+#endif
+#if KP_META == KP_META_TABLE
+  int cls;
+  
+  KP_ENTER();
+  cls = KP_(meta)[page_frame(ptr)].cls;
+  if (cls == KP_LARGE)
+    {
+      free_pages(page_lookup(ptr));
+      KP_LEAVE();
+      return;
+    }
+  
+  assert(cls == KP_CLASS(size));
+  
+  KP_(put)(ptr, cls);
+  KP_LEAVE();
+#else
+  int cls;
+  
+  if (size > KP_MAXSMALL)
+    { // it came straight from the page buddy
+      KP_ENTER();
+      free_pages(page_lookup(ptr));
+      KP_LEAVE();
+      return;
+    }
+  
+  cls = KP_CLASS(size);
+  
+  KP_ENTER();
+  KP_(put)(ptr, cls);
+  KP_LEAVE();
+#endif
+}
+
+/* takes a block off the class list, refilling it if needed; holds the lock */
+static void*
+KP_(get)(int cls)
+{
+  klist_t* res;
+  
+  if (klist_empty(&KP_(lists)[cls]) && !KP_(refill)(cls))
+    {
+      return NULL;
+    }
+  
+  res = klist_pop(&KP_(lists)[cls]);
+#if KP_META == KP_META_TABLE
+  KP_(meta)[KP_HEAD(res)].count++;
+#else
+  page_lookup(res)->count++;
+#endif
+  
+  return res;
+}
+
+/* puts a block back on the class list, releasing an idle slab unless
+ * it becomes the spare; holds the lock */
+static void
+KP_(put)(void* ptr, int cls)
+{
+  void* base;
+#if KP_META == KP_META_PAGE
+  kpage_t* page;
+#endif
+  
+  klist_add(&KP_(lists)[cls], (klist_t*)ptr);
+#if KP_META == KP_META_TABLE
+  if (--KP_(meta)[KP_HEAD(ptr)].count > 0)
+    {
+      return;
+    }
+  base = BASEADDR(ptr) - (page_frame(ptr) - KP_HEAD(ptr)) * PAGESIZE;
+#else
+  page = page_lookup(ptr);
+  if (--page->count > 0)
+    {
+      return;
+    }
+  base = page->ptr;
+#endif
+  
+  // the spare may have had blocks handed out since, then this one takes over
+  if (KP_(spare)[cls] == NULL || KP_(spare)[cls] == base
+      || KP_COUNT(KP_(spare)[cls]) > 0)
+    {
+      KP_(spare)[cls] = base;
+      return;
+    }
+  KP_(release)(base, cls);
+}
+
+/* whole pages for requests larger than a slab block */
+static void*
+KP_(large)(kma_size_t size)
+{
+  kpage_t* page;
+  
+  if (size > (PAGESIZE << (MAXORDER - 1)))
+    {
+      return NULL;
+    }
+  
+  KP_ENTER();
+#if KP_META == KP_META_TABLE
+  if (KP_(meta) == NULL)
+    {
+      KP_(metainit)();
+    }
+#endif
+  page = get_pages(get_order(size));
+  if (page == NULL)
+    {
+      KP_LEAVE();
+      return NULL;
+    }
+#if KP_META == KP_META_TABLE
+  KP_(meta)[page_frame(page->ptr)].cls = KP_LARGE;
+#endif
+  KP_LEAVE();
+  
+  return page->ptr;
+}
+
+/* carves a new slab into blocks of a class */
+static int
+KP_(refill)(int cls)
+{
+  kpage_t* page;
+  int i;
+  
+#if KP_META == KP_META_TABLE
+  if (KP_(meta) == NULL)
+    {
+      KP_(metainit)();
+    }
+#endif
+  
+  page = get_pages(KP_SLAB);
+  if (page == NULL)
+    {
+      return 0;
+    }
+  
+#if KP_META == KP_META_TABLE
+  for (i = 0; i < (1 << KP_SLAB); i++)
+    {
+      KP_(meta)[page_frame(page->ptr) + i].cls = cls;
+    }
+  KP_(meta)[page_frame(page->ptr)].count = 0;
+#endif
+  
+  // push in reverse so blocks are handed out in address order
+  for (i = KP_OBJS(cls) - 1; i >= 0; i--)
+    {
+      klist_add(&KP_(lists)[cls], (klist_t*)(page->ptr + i * KP_SIZE(cls)));
+    }
+  
+  return 1;
+}
+
+/* the slab went idle, take its blocks off the list and return it */
+static void
+KP_(release)(void* base, int cls)
+{
+  int i;
+  
+  for (i = 0; i < KP_OBJS(cls); i++)
+    {
+      klist_del((klist_t*)(base + i * KP_SIZE(cls)));
+    }
+  free_pages(page_lookup(base));
+}
+
+/* gives back this thread's cached blocks and the idle spare slabs */
+static void
+KP_(flush)()
+{
+  int cls;
+  
+#if KP_TCACHE > 0
+  KP_(tcdrain)();
+#endif
+  KP_ENTER();
+  for (cls = 0; cls < KP_NUMCLASSES; cls++)
+    {
+      if (KP_(spare)[cls] != NULL && KP_COUNT(KP_(spare)[cls]) == 0)
+	{
+	  KP_(release)(KP_(spare)[cls], cls);
+	}
+      KP_(spare)[cls] = NULL;
+    }
+  KP_LEAVE();
+}
+
+#if KP_META == KP_META_TABLE
+/* the table is indexed by frame number, so size it to the pool */
+static void
+KP_(metainit)()
+{
+  KP_(nmeta) = page_capacity();
+  KP_(meta) = mmap(NULL, (size_t) KP_(nmeta) * sizeof(kp_meta_t),
+		   PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (KP_(meta) == MAP_FAILED)
+    error("Error using mmap to allocate the slab table", "");
+}
+
+/* the run is over, give the table back */
+static void
+KP_(metafini)()
+{
+  munmap(KP_(meta), (size_t) KP_(nmeta) * sizeof(kp_meta_t));
+  KP_(meta) = NULL;
+  KP_(nmeta) = 0;
+}
+#endif
+
+#if KP_TCACHE > 0
+static inline void
+KP_(tcpush)(void* ptr, int cls)
+{
+  *(void**)ptr = KP_(tchead)[cls];
+  KP_(tchead)[cls] = ptr;
+  KP_(tccount)[cls]++;
+}
+
+static inline void*
+KP_(tcpop)(int cls)
+{
+  void* res = KP_(tchead)[cls];
+  
+  KP_(tchead)[cls] = *(void**)res;
+  KP_(tccount)[cls]--;
+  return res;
+}
+
+/* called whenever a list of this thread's is about to get its first
+ * block, so that the thread flushes them all on exit */
+static void
+KP_(tcregister)()
+{
+  if (pthread_getspecific(KP_(tckey)) == NULL)
+    {
+      pthread_setspecific(KP_(tckey), (void*) 1);
+    }
+}
+
+/* refills this thread's empty list of a class and returns a block of it */
+static void*
+KP_(tcfill)(int cls)
+{
+  void* ptr;
+  int i;
+  
+  KP_(tcregister)();
+  
+  KP_ENTER();
+  for (i = 0; i < KP_TCBATCH(cls); i++)
+    {
+      ptr = KP_(get)(cls);
+      if (ptr == NULL)
+	{
+	  break;
+	}
+      KP_(tcpush)(ptr, cls);
+    }
+  KP_LEAVE();
+  
+  return KP_(tccount)[cls] > 0 ? KP_(tcpop)(cls) : NULL;
+}
+
+/* gives n of this thread's cached blocks of a class back to the list */
+static void
+KP_(tcflush)(int cls, int n)
+{
+  KP_ENTER();
+  for (; n > 0 && KP_(tccount)[cls] > 0; n--)
+    {
+      KP_(put)(KP_(tcpop)(cls), cls);
+    }
+  KP_LEAVE();
+}
+
+/* empties this thread's cache */
+static void
+KP_(tcdrain)()
+{
+  int cls;
+  
+  for (cls = 0; cls < KP_NUMCLASSES; cls++)
+    {
+      if (KP_(tccount)[cls] > 0)
+	{
+	  KP_(tcflush)(cls, KP_(tccount)[cls]);
+	}
+    }
+}
+
+static void
+KP_(tcexit)(void* unused)
+{
+  KP_(tcdrain)();
+}
+#endif
+
+#undef KP_NAME
+#undef KP_CLASSES
+#undef KP_SLAB
+#undef KP_META
+#undef KP_LOCK
+#undef KP_MAXSMALL
+#undef KP_TCACHE
+#undef KP_TCLIMIT
+#undef KP_TCBATCH
+#undef KP_
+#undef KP_NUMCLASSES
+#undef KP_CLASS
+#undef KP_SIZE
+#undef KP_SLABSIZE
+#undef KP_OBJS
+#undef KP_HEAD
+#undef KP_COUNT
+#undef KP_ENTER
+#undef KP_LEAVE
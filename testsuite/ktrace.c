@@ -0,0 +1,226 @@
+/***************************************************************************
+ *  Title: Traces
+ * -------------------------------------------------------------------------
+ *    Purpose: Loads allocation traces, text or binary, into an array of
+ *             fixed-width op records the harness replays directly
+ *    File: $RCSfile: ktrace.c,v $
+ ***************************************************************************/
+#define __KTRACE_IMPL__
+
+/************System include***********************************************/
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/************Private include**********************************************/
+#include "ktrace.h"
+#include "kma.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+static void map_binary(char*, int, size_t, ktrace_t*);
+static void parse_text(char*, ktrace_t*);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+void
+trace_open(char* file, ktrace_t* trace)
+{
+  struct stat st;
+  unsigned int magic = 0;
+  int fd;
+  
+  memset(trace, 0, sizeof(ktrace_t));
+  
+  fd = open(file, O_RDONLY);
+  if (fd == -1)
+    {
+      error("unable to open input test file", file);
+    }
+  if (fstat(fd, &st) == -1)
+    {
+      error("unable to stat input test file", file);
+    }
+  
+  if (read(fd, &magic, sizeof(magic)) == sizeof(magic) && magic == TRACEMAGIC)
+    {
+      map_binary(file, fd, st.st_size, trace);
+    }
+  else
+    {
+      parse_text(file, trace);
+    }
+  
+  close(fd);
+}
+
+void
+trace_close(ktrace_t* trace)
+{
+  if (trace->map != NULL)
+    {
+      munmap(trace->map, trace->maplen);
+    }
+  else
+    {
+      free(trace->ops);
+    }
+  trace->ops = NULL;
+  trace->map = NULL;
+}
+
+void
+trace_write(FILE* out, ktrace_t* trace)
+{
+  ktrace_hdr_t hdr = trace->hdr;
+  
+  hdr.magic = TRACEMAGIC;
+  hdr.version = TRACEVERSION;
+  
+  if (fwrite(&hdr, sizeof(hdr), 1, out) != 1
+      || fwrite(trace->ops, sizeof(ktrace_op_t), hdr.n_ops, out) != hdr.n_ops)
+    {
+      error("unable to write binary trace", "");
+    }
+}
+
+/* maps a binary trace; the records follow the header in place */
+static void
+map_binary(char* file, int fd, size_t len, ktrace_t* trace)
+{
+  ktrace_hdr_t* hdr;
+  
+  if (len < sizeof(ktrace_hdr_t))
+    {
+      error("truncated trace header", file);
+    }
+  
+  trace->map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (trace->map == MAP_FAILED)
+    {
+      error("unable to map trace", file);
+    }
+  trace->maplen = len;
+  
+  // the replay walks the records once, front to back
+  madvise(trace->map, len, MADV_SEQUENTIAL);
+  
+  hdr = trace->map;
+  if (hdr->version != 1 && hdr->version != TRACEVERSION)
+    {
+      error("unsupported trace version", file);
+    }
+  if (len != sizeof(ktrace_hdr_t) + hdr->n_ops * sizeof(ktrace_op_t))
+    {
+      error("trace length does not match its header", file);
+    }
+  
+  trace->hdr = *hdr;
+  trace->ops = (ktrace_op_t*)(hdr + 1);
+  if (hdr->version == 1)
+    { // the field was reserved and written as 0
+      trace->hdr.version = TRACEVERSION;
+      trace->hdr.n_threads = 1;
+    }
+  if (trace->hdr.n_threads < 1 || trace->hdr.n_threads > MAXSTREAMS)
+    {
+      error("bad stream count in trace header", file);
+    }
+}
+
+/* parses a text trace into freshly allocated records */
+static void
+parse_text(char* file, ktrace_t* trace)
+{
+  size_t cap = 1024, n = 0;
+  ktrace_op_t* ops;
+  char command[16];
+  int id, size, tid = 0;
+  
+  FILE* f_test = fopen(file, "r");
+  if (f_test == NULL)
+    {
+      error("unable to open input test file", file);
+    }
+  
+  // Get the number of requests in the trace file
+  if (fscanf(f_test, "%u\n", &trace->hdr.n_req) != 1)
+    error("Couldn't read number of requests at head of file", "");
+  
+  ops = malloc(cap * sizeof(ktrace_op_t));
+  assert(ops != NULL);
+  
+  // Parse the lines in the file into REQUEST and FREE records
+  while (fscanf(f_test, "%10s", command) == 1)
+    {
+      if (n == cap)
+	{
+	  cap *= 2;
+	  ops = realloc(ops, cap * sizeof(ktrace_op_t));
+	  assert(ops != NULL);
+	}
+  
+      if (strcmp(command, "REQUEST") == 0)
+	{
+	  if (fscanf(f_test, "%d %d", &id, &size) != 2)
+	    error("Not enough arguments to REQUEST", "");
+	  if (size <= 0)
+	    error("REQUEST of a non-positive size", "");
+	  if (size > MAXOPSIZE)
+	    error("REQUEST larger than a trace can hold", "");
+	}
+      else if (strcmp(command, "FREE") == 0)
+	{
+	  if (fscanf(f_test, "%d", &id) != 1)
+	    error("Not enough arguments to FREE", "");
+	  size = OPFREE;
+	}
+      else if (strcmp(command, "THREAD") == 0)
+	{
+	  if (fscanf(f_test, "%d", &tid) != 1)
+	    error("Not enough arguments to THREAD", "");
+	  if (tid < 0 || tid >= MAXSTREAMS)
+	    error("THREAD out of range", "");
+	  if (tid >= trace->hdr.n_threads)
+	    trace->hdr.n_threads = tid + 1;
+	  continue;
+	}
+      else
+	{
+	  error("unknown command type:", command);
+	}
+  
+      assert(id >= 0 && id < trace->hdr.n_req);
+  
+      ops[n].id = id;
+      ops[n].size = size;
+      ops[n].tid = tid;
+      n++;
+    }
+  
+  fclose(f_test);
+  
+  trace->hdr.magic = TRACEMAGIC;
+  trace->hdr.version = TRACEVERSION;
+  if (trace->hdr.n_threads == 0)
+    {
+      trace->hdr.n_threads = 1;
+    }
+  trace->hdr.n_ops = n;
+  trace->ops = ops;
+}
@@ -0,0 +1,70 @@
+/***************************************************************************
+ *  Title: Trace Converter
+ * -------------------------------------------------------------------------
+ *    Purpose: Converts a text trace into the binary format the harness
+ *             maps and replays in place
+ *    File: $RCSfile: trace2bin.c,v $
+ ***************************************************************************/
+
+/************System include***********************************************/
+#include <stdlib.h>
+#include <stdio.h>
+
+/************Private include**********************************************/
+#include "ktrace.h"
+
+/************Defines and Typedefs*****************************************/
+/*  #defines and typedefs should have their names in all caps.
+ *  Global variables begin with g. Global constants with k. Local
+ *  variables should be in all lower case. When initializing
+ *  structures and arrays, line everything up in neat columns.
+ */
+
+/************Global Variables*********************************************/
+
+/************Function Prototypes******************************************/
+void error(char*, char*);
+
+/************External Declaration*****************************************/
+
+/**************Implementation***********************************************/
+
+int
+main(int argc, char* argv[])
+{
+  ktrace_t trace;
+  FILE* out;
+  
+  if (argc != 3)
+    {
+      printf("Usage: %s traceFile binaryTraceFile\n", argv[0]);
+      exit(0);
+    }
+  
+  // a binary input is simply copied, so the converter is idempotent
+  trace_open(argv[1], &trace);
+  
+  out = fopen(argv[2], "w");
+  if (out == NULL)
+    {
+      error("unable to open output file", argv[2]);
+    }
+  trace_write(out, &trace);
+  if (fclose(out) != 0)
+    {
+      error("unable to write output file", argv[2]);
+    }
+  
+  printf("%s: %u requests, %llu ops, %u streams\n", argv[2], trace.hdr.n_req,
+	 trace.hdr.n_ops, trace.hdr.n_threads);
+  
+  trace_close(&trace);
+  return 0;
+}
+
+void
+error(char* message, char* arg)
+{
+  fprintf(stderr, "ERROR: %s: %s.\n", message, arg);
+  exit(-1);
+}